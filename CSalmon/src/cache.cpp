@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "cache.h"
+#include "compiler.h"
+#include "vm.h"
+
+namespace fs = std::filesystem;
+
+// 写入缓存项的进程如果在重命名之前崩溃了，它的临时文件会一直留在目录中。比这更旧的临时文件不可能还有进程在写，淘汰时会被删除。
+#define STALE_TEMP_AGE std::chrono::hours(1)
+
+// 缓存键是源代码的64位FNV-1a哈希，之后再混入源代码的长度、两个版本号以及窥孔优化是否打开。
+// 任何一项不同，生成的字节码都可能不同，所以它们必须得到不同的键。
+static uint64_t cacheKey(const char* source) {
+	uint64_t hash = 14695981039346656037ull;
+	size_t length = strlen(source);
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)source[i];
+		hash *= 1099511628211ull;
+	}
+
+	uint64_t salt[] = { length, SALC_VERSION, COMPILER_VERSION, vm.peephole ? 1u : 0u };
+	const uint8_t* bytes = (const uint8_t*)salt;
+	for (size_t i = 0; i < sizeof(salt); i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+typedef struct {
+	fs::path path;
+	uintmax_t size;
+	fs::file_time_type lastUsed;
+} CacheEntry;
+
+// 如果缓存目录中所有.salc文件的总大小超过了maxBytes，就按最后使用时间从旧到新删除，直到不超过上限。刚刚写入的keep永远不会被删除。
+// 同时删除崩溃的进程留下的过期临时文件。
+// 其它进程可能同时在读写这个目录，所以任何一步失败（例如文件已经被别人删掉了）我们都直接跳过。
+static void evict(const fs::path& dir, size_t maxBytes, const fs::path& keep) {
+	std::error_code error;
+	std::vector<CacheEntry> entries;
+	uintmax_t total = 0;
+	fs::file_time_type staleBefore = fs::file_time_type::clock::now() - STALE_TEMP_AGE;
+	for (fs::directory_iterator it(dir, error), end; !error && it != end; it.increment(error)) {
+		std::error_code entryError;
+		if (it->path().extension() == ".tmp") {
+			fs::file_time_type written = it->last_write_time(entryError);
+			if (!entryError && written < staleBefore) fs::remove(it->path(), entryError);
+			continue;
+		}
+		if (it->path().extension() != ".salc") continue;
+		CacheEntry entry = { it->path(), it->file_size(entryError), it->last_write_time(entryError) };
+		if (entryError) continue;
+		entries.push_back(entry);
+		total += entry.size;
+	}
+	if (total <= maxBytes) return;
+
+	std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+		return a.lastUsed < b.lastUsed;
+	});
+	for (const CacheEntry& entry : entries) {
+		if (total <= maxBytes) break;
+		if (entry.path == keep) continue;
+		if (fs::remove(entry.path, error)) {
+			total -= entry.size;
+			vm.cacheEvictions++;
+		}
+	}
+}
+
+CacheResult loadCachedBytecode(const char* cacheDir, size_t maxBytes, const char* source, BytecodeImage* image) {
+	std::error_code error;
+	fs::path dir(cacheDir);
+	fs::create_directories(dir, error);
+	if (error) return CACHE_UNAVAILABLE;
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.salc", (unsigned long long)cacheKey(source));
+	fs::path path = dir / name;
+
+	// 命中时更新文件的修改时间，这样淘汰时最近使用过的缓存项会被保留下来。
+	// 一个已经损坏的缓存项会被悄悄地删除，然后像未命中一样重新编译。
+	if (fs::exists(path, error)) {
+		LoadResult loaded = loadBytecodeFile(path.string().c_str(), image, true);
+		if (loaded == LOAD_OK) {
+			fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+			vm.cacheHits++;
+			return CACHE_HIT;
+		}
+		fs::remove(path, error);
+	}
+
+	vm.cacheMisses++;
+	char tempName[64];
+	snprintf(tempName, sizeof(tempName), "%s.%d.tmp", name, (int)getpid());
+	fs::path tempPath = dir / tempName;
+	// 无论命中还是未命中，执行的都是从缓存项载入的块，--dump-bytecode由interpretChunk()在执行前打印它。所以编译时不要再打印一次。
+	bool printCode = vm.printCode;
+	vm.printCode = false;
+	InterpretResult compiled = compileToFile(source, tempPath.string().c_str());
+	vm.printCode = printCode;
+	if (compiled != INTERPRET_OK) {
+		fs::remove(tempPath, error);
+		return compiled == INTERPRET_COMPILE_ERROR ? CACHE_COMPILE_ERROR : CACHE_UNAVAILABLE;
+	}
+
+	// 重命名是原子的：其它进程要么看不到这个缓存项，要么看到完整的文件。如果两个进程同时编译了同一个脚本，后完成的那个会覆盖前一个，内容是相同的。
+	fs::rename(tempPath, path, error);
+	if (error) {
+		fs::remove(tempPath, error);
+		return CACHE_UNAVAILABLE;
+	}
+	evict(dir, maxBytes, path);
+
+	if (loadBytecodeFile(path.string().c_str(), image, true) != LOAD_OK) return CACHE_UNAVAILABLE;
+	return CACHE_MISS;
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#ifndef csalmon_cache_h
+#define csalmon_cache_h
+
+#include "serializer.h"
+
+// 编译缓存把脚本的编译结果以.salc文件的形式保存在一个目录中，键是源代码字节的哈希值，再混入编译器版本、文件格式版本和影响代码生成的选项。
+// 同一个脚本再次运行时，只要源代码没有变化，就直接映射缓存中的字节码，完全跳过扫描和编译。
+// 因为键只取决于内容，所以同一份脚本无论从哪个路径运行、被复制了多少份，都共享同一个缓存项；脚本一旦被修改，旧的缓存项就不会再被用到，最终被淘汰。
+//
+// 新的缓存项先写入一个临时文件，再重命名为最终的名字，所以并发运行的进程永远不会看到写了一半的文件。
+// 每次写入新项之后，如果目录中所有缓存项的总大小超过了上限，就按最后使用时间从旧到新删除，直到不超过上限。命中时会更新缓存项的修改时间。崩溃的进程留下的过期临时文件也会在这时被删除。
+
+// 缓存目录的默认大小上限。
+#define CACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+
+typedef enum {
+	CACHE_HIT,				// 在缓存中找到了编译结果，image中是映射好的字节码。
+	CACHE_MISS,				// 缓存中没有，已经编译并存入缓存，image中是映射好的字节码。
+	CACHE_COMPILE_ERROR,	// 源代码有编译错误，错误已经报告过了。
+	CACHE_UNAVAILABLE,		// 缓存目录无法使用。调用者应当像没有缓存一样直接编译并执行源代码。
+} CacheResult;
+
+// 在cacheDir中查找source的编译结果，没有找到就编译它并存入缓存。maxBytes是缓存目录的大小上限。
+CacheResult loadCachedBytecode(const char* cacheDir, size_t maxBytes, const char* source, BytecodeImage* image);
+
+#endif
\ No newline at end of file
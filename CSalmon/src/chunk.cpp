@@ -1,12 +1,18 @@
 #include <stdlib.h>
 
 #include "chunk.h"
+#include "memory.h"
+#include "vm.h"
 
 void initChunk(Chunk* chunk) {
 	chunk->count = 0;
 	chunk->capacity = 0;
 	chunk->code = NULL;
+	chunk->lineCount = 0;
+	chunk->lineCapacity = 0;
 	chunk->lines = NULL;
+	chunk->image = NULL;
+	chunk->constantOffsets = NULL;
 	// 初始化新的字节码块时，我们也要初始化其常量值列表。
 	initValueArray(&chunk->constants);
 }
@@ -18,26 +24,119 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
 		int oldCapacity = chunk->capacity;
 		// 要扩充数组，首先我们要算出新容量，然后将数组容量扩充到该大小。
 		chunk->capacity = GROW_CAPACITY(oldCapacity);
-		chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-		chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+		chunk->code = GROW_ARRAY(MEM_CODE, uint8_t, chunk->code, oldCapacity, chunk->capacity);
 	}
 
 	chunk->code[chunk->count] = byte;
-	chunk->lines[chunk->count] = line;
+	addLine(chunk, chunk->count, line);
 	chunk->count++;
 }
 
+void addLine(Chunk* chunk, int offset, int line) {
+	// 还在同一行，当前的最后一项已经覆盖了这个字节。
+	if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) return;
+
+	if (chunk->lineCapacity < chunk->lineCount + 1) {
+		int oldCapacity = chunk->lineCapacity;
+		chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+		chunk->lines = GROW_ARRAY(MEM_LINES, LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+	}
+
+	LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+	lineStart->offset = offset;
+	lineStart->line = line;
+}
+
+int getLine(Chunk* chunk, int offset) {
+	// 我们要找的是offset不大于给定偏移量的最后一项。
+	int start = 0;
+	int end = chunk->lineCount - 1;
+	while (start < end) {
+		int mid = start + (end - start + 1) / 2;
+		if (chunk->lines[mid].offset <= offset) {
+			start = mid;
+		}
+		else {
+			end = mid - 1;
+		}
+	}
+	return chunk->lines[start].line;
+}
+
+void truncateChunk(Chunk* chunk, int count) {
+	chunk->count = count;
+	while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+		chunk->lineCount--;
+	}
+}
+
 void freeChunk(Chunk* chunk) {
 	// 我们释放所有的内存，然后调用initChunk()将字段清零，使字节码块处于一个定义明确的空状态。
-	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-	FREE_ARRAY(int, chunk->lines, chunk->capacity);
+	if (chunk->image == NULL) {
+		FREE_ARRAY(MEM_CODE, uint8_t, chunk->code, chunk->capacity);
+		FREE_ARRAY(MEM_LINES, LineStart, chunk->lines, chunk->lineCapacity);
+	}
 	// 我们在释放字节码块时，也需要释放常量值。
-	freeValueArray(&chunk->constants);
+	freeValueArray(&chunk->constants, MEM_CONSTANTS);
 	initChunk(chunk);
 }
 
 int addConstant(Chunk* chunk, Value value) {
-	writeValueArray(&chunk->constants, value);
+	// 扩展常量表时可能会触发垃圾回收，而value在写入常量表之前还没有从任何根可达，所以我们暂时把它压入栈中。
+	push(value);
+	writeValueArray(&chunk->constants, value, MEM_CONSTANTS);
+	pop();
 	// 在添加常量之后，我们返回追加常量的索引，以便后续可以定位到相同的常量。
-	return chunk->constants.count - 1;
+	int index = chunk->constants.count - 1;
+	// 写屏障：常量表属于老年代。
+	if (IS_YOUNG(value)) rememberSlot(&chunk->constants, index);
+	return index;
+}
+
+// 收缩不会触发垃圾回收，而且realloc()通常可以原地完成，不需要复制。
+void shrinkChunk(Chunk* chunk) {
+	chunk->code = GROW_ARRAY(MEM_CODE, uint8_t, chunk->code, chunk->capacity, chunk->count);
+	chunk->capacity = chunk->count;
+	chunk->lines = GROW_ARRAY(MEM_LINES, LineStart, chunk->lines, chunk->lineCapacity, chunk->lineCount);
+	chunk->lineCapacity = chunk->lineCount;
+	ValueArray* constants = &chunk->constants;
+	constants->values = GROW_ARRAY(MEM_CONSTANTS, Value, constants->values, constants->capacity, constants->count);
+	constants->capacity = constants->count;
+}
+
+int instructionLength(uint8_t instruction) {
+	switch (instruction) {
+	case OP_CONSTANT:
+	case OP_GET_LOCAL:
+	case OP_SET_LOCAL:
+	case OP_ADD_CONSTANT:
+		return 2;
+	case OP_GET_GLOBAL:
+	case OP_DEFINE_GLOBAL:
+	case OP_SET_GLOBAL:
+	case OP_JUMP:
+	case OP_JUMP_IF_FALSE:
+	case OP_LOOP:
+	case OP_ADD_LOCALS:
+	case OP_LESS_JUMP_IF_FALSE:
+		return 3;
+	case OP_PRINT:
+	case OP_RETURN:
+	case OP_NIL:
+	case OP_TRUE:
+	case OP_FALSE:
+	case OP_POP:
+	case OP_EQUAL:
+	case OP_GREATER:
+	case OP_LESS:
+	case OP_ADD:
+	case OP_SUBTRACT:
+	case OP_MULTIPLY:
+	case OP_DIVIDE:
+	case OP_NOT:
+	case OP_NEGATE:
+		return 1;
+	default:
+		return 0;
+	}
 }
\ No newline at end of file
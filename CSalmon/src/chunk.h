@@ -2,7 +2,6 @@
 #define csalmon_chunk_h
 
 #include "common.h"
-#include "memory.h"
 #include "value.h"
 
 // 在我们的字节码格式中，每个指令都有一个字节的操作码（通常简称为opcode）。这个数字控制我们要处理的指令类型——加、减、查找变量等。
@@ -39,24 +38,55 @@ typedef enum {
 	// 一元操作符
 	OP_NOT,
 	OP_NEGATE,
+	// --------------------------------
+	// 超级指令。编译器从不直接生成它们，它们是窥孔优化把常见的指令序列融合之后的结果。
+	OP_ADD_LOCALS,			// OP_GET_LOCAL a; OP_GET_LOCAL b; OP_ADD
+	OP_LESS_JUMP_IF_FALSE,	// OP_LESS; OP_JUMP_IF_FALSE offset; OP_POP
+	OP_ADD_CONSTANT,		// OP_CONSTANT k; OP_ADD
 } Opcode;
 
 // 字节码是一系列指令。最终，我们会与指令一起存储一些其它数据，所以让我们继续创建一个结构体来保存所有这些数据。
 // 由于我们在开始编译块之前不知道数组需要多大，所以它必须是动态的。动态数组是我最喜欢的数据结构之一。
 // 动态数组提供了：缓存友好，密集存储、索引元素查找为常量时间复杂度、数组末尾追加元素为常量时间复杂度。
+// 行号表使用游程编码。同一行源代码通常会编译出一连串的字节，所以我们不再为每个字节存储一个行号，
+// 而是只在行号发生变化的地方记录一项：从offset开始的字节（直到下一项的offset之前）都来自line这一行。
+typedef struct {
+	int offset;
+	int line;
+} LineStart;
+
 typedef struct {
 	int count;
 	int capacity;
 	uint8_t* code;
-	int* lines;				// 该数组与字节码平级。数组中的每个数字都是字节码中对应字节所在的行号。。
+	// 行号表中的各项按offset递增排列，所以可以用二分查找找到任意字节所在的行。
+	int lineCount;
+	int lineCapacity;
+	LineStart* lines;
 	ValueArray constants;	// 保存字节码块中的常量值。
+	// 从.salc文件载入的字节码块直接使用映射到内存中的字节码和行号表，image指向文件的起始位置。这样的块不拥有code和lines，释放时也不能释放它们。
+	// 它的字符串常量在第一次被用到时才会驻留，constantOffsets给出每个常量的记录在文件中的位置。编译出来的块中这两个字段都是NULL。
+	const uint8_t* image;
+	const uint32_t* constantOffsets;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 void freeChunk(Chunk* chunk);
+// 记录从offset开始的字节来自line这一行。如果它与行号表中最后一项的行号相同，就什么也不做。
+// writeChunk()会自动调用它，只有直接改写字节码的代码（例如窥孔优化）才需要自己调用。
+void addLine(Chunk* chunk, int offset, int line);
+// 返回offset处的字节所在的源代码行。
+int getLine(Chunk* chunk, int offset);
+// 丢弃count之后的所有字节以及它们在行号表中的项。
+void truncateChunk(Chunk* chunk, int count);
 // 我们定义一个便捷的方法来向字节码块中添加一个新常量。
 int addConstant(Chunk* chunk, Value value);
+// 编译结束时调用：数组按倍数增长，最后往往有接近一半的容量没有用到。这个函数把字节码、行号表和常量表都收缩到正好等于元素个数的大小。
+void shrinkChunk(Chunk* chunk);
+// 要逐条遍历字节码，我们需要知道每条指令有多长。这个函数返回一条指令的总字节数：操作码本身占一个字节，之后是它的操作数。
+// 未知的操作码返回0。编译器不会生成它们，但从.salc文件载入的字节码可能含有任何字节。
+int instructionLength(uint8_t instruction);
 
 //class Chunk {
 //private:
@@ -5,12 +5,56 @@
 #include <stddef.h>
 #include <stdint.h>
 
-// 当这个标志被定义后，我们使用现有的“debug”模块打印出块中的字节码。
-#define DEBUG_PRINT_CODE
-// 定义了这个标志之后，虚拟机在执行每条指令之前都会反汇编并将其打印出来。
-#define DEBUG_TRACE_EXECUTION
+// GCC和Clang支持“标签作为值”扩展（&&label），虚拟机用它来实现线程化的指令分派。MSVC不支持这个扩展，在那里我们退回到可移植的switch循环。
+// 如果想在GCC或Clang上比较两种分派方式，可以在编译时定义NO_COMPUTED_GOTO来强制使用switch循环。
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+// 定义NAN_BOXING会把每个Value压缩进一个NaN装箱的64位字中，而不是使用16字节的带标签联合体。两种表示的行为完全相同，只是内存布局不同。
+// 它默认是关闭的，在编译时定义它（例如-DNAN_BOXING，或在项目属性的预处理器定义中加入）即可打开。
+// 在x86上，扫描器用SSE2一次检查16个字节（编译时打开了AVX2时用AVX2一次检查32个字节），来跳过空白、注释、字符串、标识符和数字。其它平台上使用逐字节的扫描。
+// 两种扫描产生的词法标识和行号完全相同。如果想比较两者的吞吐量，可以在编译时定义SCALAR_SCANNER来强制使用逐字节的扫描。
+#if !defined(SCALAR_SCANNER)
+#if defined(__AVX2__)
+#define SCANNER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCANNER_SSE2
+#endif
+#endif
+// 哈希表在x86上用SSE2一次比较一组16个控制字节。在编译时定义SCALAR_TABLE可以强制使用逐字节的比较。
+#if !defined(SCALAR_TABLE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TABLE_SSE2
+#endif
+// reallocate()默认使用分级内存池来分配小块内存（见memory.cpp）。在编译时定义SYSTEM_ALLOCATOR可以让所有的分配都直接交给系统的realloc()，便于比较两者。
+#if !defined(SYSTEM_ALLOCATOR)
+#define POOL_ALLOCATOR
+#endif
+// reallocate()按用途对每次分配分类，分别统计存活字节数、峰值和分配次数，供--mem-stats报告。
+// 它们定义在这里而不是memory.h中，因为value.h中的动态数组和vm.h中的虚拟机状态也需要它们，而这两个头文件都不能包含memory.h。
+typedef enum {
+	MEM_STRING,		// 字符串对象、ObjBuilder以及它们共享的缓冲区。
+	MEM_FUNCTION,	// 函数对象本身，不包括它的字节码块。
+	MEM_CODE,		// 字节码块中的字节码。
+	MEM_LINES,		// 字节码块的行号表。
+	MEM_CONSTANTS,	// 字节码块的常量表。
+	MEM_TABLE,		// 除驻留表之外的哈希表（例如全局变量名到槽号的映射）的控制字节和条目。
+	MEM_INTERNER,	// 字符串驻留表的控制字节和条目。
+	MEM_GLOBALS,	// 按槽号保存全局变量的值和名称的数组。
+	MEM_COMPILER,	// 编译器的竞技场。
+	MEM_OTHER,		// 其它：序列化缓冲区、源代码列表等。
+	MEM_CATEGORY_COUNT,
+} MemoryCategory;
+
+// 一个分类的内存统计。live是当前存活的字节数，peak是它曾经达到的最大值，allocations是分配新内存块的次数（不包括调整已有块的大小）。
+typedef struct {
+	size_t live;
+	size_t peak;
+	uint64_t allocations;
+} MemoryStats;
+
 // 由于我们用来编码局部变量的指令操作数是一个字节，所以我们的虚拟机对同时处于作用域内的局部变量的数量有一个硬性限制。
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #endif
 
@@ -5,11 +5,10 @@
 
 #include "common.h"
 #include "compiler.h"
-#include "scanner.h"
-
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
+#include "memory.h"
+#include "optimizer.h"
+#include "scanner.h"
 
 // 像我们要构建的单遍编译器并不是对所有语言都有效。
 // 因为编译器在生产代码时只能“管窥”用户的程序，所以语言必须设计成不需要太多外围的上下文环境就能理解一段语法。
@@ -100,6 +99,10 @@ typedef struct {
 	// 我们还会跟踪“作用域深度”。这指的是我们正在编译的当前代码外围的代码块数量。
 	// 0是全局作用域，1是第一个顶层块，2是它内部的块，你懂的。我们用它来跟踪每个局部变量属于哪个块，这样当一个块结束时，我们就知道该删除哪些局部变量。
 	int scopeDepth;
+	// 常量折叠需要知道最近生成的那条指令是不是单独压入了一个常量（OP_CONSTANT、OP_NIL、OP_TRUE或OP_FALSE）。
+	// 如果是，lastConstant就是它在字节码块中的起始偏移量，lastConstantValue是它压入的值。生成任何其它指令都会把lastConstant重置为-1。
+	int lastConstant;
+	Value lastConstantValue;
 } Compiler;
 
 // 如果我们是有原则的工程师，我们应该给前端的每个函数添加一个参数，接受一个指向Compiler的指针。
@@ -107,10 +110,8 @@ typedef struct {
 // 但这意味着要对我们已经写好的代码进行大量无聊的修改，所以这里用一个全局变量代替。
 Compiler* current = NULL;
 
-// 当前的字节码块一定是我们正在编译的函数所拥有的块。
-static Chunk* currentChunk() {
-	return &current->function->chunk;
-}
+// 编译器的竞技场。每次compile()开始时初始化，结束时释放。
+static Arena compileArena;
 
 static void binary(bool canAssign);
 static void literal(bool canAssign);
@@ -273,6 +274,7 @@ static bool match(TokenType type) {
 // 在我们解析并理解了用户的一段程序之后，下一步是将其转换为一系列字节码指令。
 static void emitByte(uint8_t byte) {
 	writeChunk(currentChunk(), byte, parser.previous.line);
+	current->lastConstant = -1;
 }
 
 static void emitBytes(uint8_t byte1, uint8_t byte2) {
@@ -280,6 +282,13 @@ static void emitBytes(uint8_t byte1, uint8_t byte2) {
 	emitByte(byte2);
 }
 
+// 全局变量的槽号是一个16位的操作数，以大端序紧跟在操作码之后，与跳转偏移量的编码方式相同。
+static void emitShortOperand(uint8_t instruction, uint16_t operand) {
+	emitByte(instruction);
+	emitByte((operand >> 8) & 0xff);
+	emitByte(operand & 0xff);
+}
+
 static void emitReturn() {
 	emitByte(OP_RETURN);
 }
@@ -296,9 +305,113 @@ static uint8_t makeConstant(Value value) {
 	return (uint8_t)constant;
 }
 
+// 记录刚刚从start开始生成的那条指令只是压入了常量value。
+static void markConstant(int start, Value value) {
+	current->lastConstant = start;
+	current->lastConstantValue = value;
+}
+
 static void emitConstant(Value value) {
 	// 首先，我们将值添加到常量表中，然后我们发出一条OP_CONSTANT指令，在运行时将其压入栈中。
+	int start = currentChunk()->count;
 	emitBytes(OP_CONSTANT, makeConstant(value));
+	markConstant(start, value);
+}
+
+// ------------------常量折叠------------------
+// 当一个运算符的操作数全都是常量时，编译器可以直接算出结果，只生成一条压入结果的指令，而不必每次运行时都分派、检查类型并计算。
+// 这对写在循环里的60 * 60 * 24或者"a" + "b"这样的表达式尤其有用。因为是单遍编译器，我们只能在操作数的代码已经生成之后才知道它们是常量，
+// 所以做法是丢弃这些代码，再生成折叠后的结果。
+
+// nil、true和false有专门的指令，不需要占用常量表。
+static void emitValue(Value value) {
+	int start = currentChunk()->count;
+	if (IS_BOOL(value)) {
+		emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+	}
+	else if (IS_NIL(value)) {
+		emitByte(OP_NIL);
+	}
+	else {
+		emitConstant(value);
+		return;
+	}
+	markConstant(start, value);
+}
+
+// 丢弃从start开始生成的常量指令。它们引用的常量如果位于常量表的末尾，也一并移除，这样折叠不会白白占用常量表中有限的位置。
+// 要丢弃的最多只有两条指令（二元运算符的两个操作数），所以我们按相反的顺序处理它们的常量。
+static void discardConstants(int start) {
+	Chunk* chunk = currentChunk();
+	int constants[2];
+	int constantCount = 0;
+	for (int offset = start; offset < chunk->count;) {
+		if (chunk->code[offset] == OP_CONSTANT) {
+			constants[constantCount++] = chunk->code[offset + 1];
+			offset += 2;
+		}
+		else {
+			offset++;
+		}
+	}
+	for (int i = constantCount - 1; i >= 0; i--) {
+		if (constants[i] == chunk->constants.count - 1) chunk->constants.count--;
+	}
+
+	truncateChunk(chunk, start);
+	current->lastConstant = -1;
+}
+
+// 尝试在编译时计算一个二元运算。只有当运行时这个运算一定会成功时，我们才会折叠它。
+// 如果操作数的类型不对，我们就返回false，让编译器照常生成指令，这样运行时错误的信息和行号都与以前完全相同。
+// 比较运算的结果必须与虚拟机的实现一致，例如a >= b被编译为!(a < b)，所以当有NaN参与时它的结果与直接比较并不相同。
+static bool foldBinary(TokenType operatorType, Value a, Value b, Value* result) {
+	switch (operatorType) {
+	case TOKEN_EQUAL_EQUAL:
+		*result = BOOL_VAL(valuesEqual(a, b));
+		return true;
+	case TOKEN_BANG_EQUAL:
+		*result = BOOL_VAL(!valuesEqual(a, b));
+		return true;
+	case TOKEN_PLUS:
+		if (IS_STRING(a) && IS_STRING(b)) {
+			*result = OBJ_VAL(concatenateStrings(AS_STRING(a), AS_STRING(b)));
+			return true;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+	double x = AS_NUMBER(a);
+	double y = AS_NUMBER(b);
+	switch (operatorType) {
+	case TOKEN_GREATER:       *result = BOOL_VAL(x > y); return true;
+	case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+	case TOKEN_LESS:          *result = BOOL_VAL(x < y); return true;
+	case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+	case TOKEN_PLUS:          *result = NUMBER_VAL(x + y); return true;
+	case TOKEN_MINUS:         *result = NUMBER_VAL(x - y); return true;
+	case TOKEN_STAR:          *result = NUMBER_VAL(x * y); return true;
+	case TOKEN_SLASH:         *result = NUMBER_VAL(x / y); return true;
+	default:                  return false;
+	}
+}
+
+// 一元运算符的折叠规则相同：!对任何值都有效，而-只对数字有效。-"str"会被保留到运行时，照常报告错误。
+static bool foldUnary(TokenType operatorType, Value value, Value* result) {
+	switch (operatorType) {
+	case TOKEN_BANG:
+		*result = BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)));
+		return true;
+	case TOKEN_MINUS:
+		if (!IS_NUMBER(value)) return false;
+		*result = NUMBER_VAL(-AS_NUMBER(value));
+		return true;
+	default:
+		return false;
+	}
 }
 
 // 当我们第一次启动虚拟机时，我们会调用它使所有东西进入一个干净的状态。
@@ -307,6 +420,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 	compiler->type = type;
 	compiler->localCount = 0;
 	compiler->scopeDepth = 0;
+	compiler->lastConstant = -1;
 	// 在编译器中创建ObjFunction可能看起来有点奇怪。函数对象是一个函数的运行时表示，但这里我们是在编译时创建它。
 	// 我们可以这样想：函数类似于一个字符串或数字字面量。它在编译时和运行时之间形成了一座桥梁。
 	// 当我们碰到函数声明时，它们确实是字面量——它们是一种生成内置类型值的符号。因此，编译器在编译期间创建函数对象。然后，在运行时，它们被简单地调用。
@@ -324,12 +438,20 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
 static ObjFunction* endCompiler() {
 	emitReturn();
 	ObjFunction* function = current->function;
-#ifdef DEBUG_PRINT_CODE
-	// 只有在代码没有错误的情况下，我们才会这样做。
-	if (!parser.hadError) {
+	// 函数体编译完成后，我们在整个字节码块上运行窥孔优化，把常见的指令序列融合成超级指令。
+	// 有错误的代码永远不会被执行，所以不需要优化它。--no-peephole可以关闭这一步，便于比较优化前后的字节码和分派次数。
+	if (vm.peephole && !parser.hadError) {
+		optimizeChunk(currentChunk(), &compileArena);
+	}
+	if (vm.printStats) {
+		vm.codeBytes += currentChunk()->count;
+		vm.lineTableBytes += currentChunk()->lineCount * sizeof(LineStart);
+	}
+	// 当用户传入--dump-bytecode时，我们使用现有的“debug”模块打印出块中的字节码。只有在代码没有错误的情况下，我们才会这样做。
+	// 这是每次编译只检查一次的运行时标志，所以不需要为了查看字节码而重新构建解释器。
+	if (vm.printCode && !parser.hadError) {
 		disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
 	}
-#endif
 	return function;
 }
 
@@ -338,6 +460,12 @@ static void statement();
 static void declaration();
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
+static void beginScope();
+static void endScope();
+static void expressionStatement();
+static int emitJump(uint8_t instruction);
+static void patchJump(int offset);
+static void emitLoop(int loopStart);
 
 static void binary(bool canAssign) {
 	// 当前缀解析函数被调用时，前缀标识已经被消耗了。中缀解析函数被调用时，情况更进一步——整个左操作数已经被编译，而随后的中缀操作符也已经被消耗掉。
@@ -346,8 +474,23 @@ static void binary(bool canAssign) {
 	// 我们可以通过getRule()动态地查找，我们很快就会讲到。有了它，我们就可以使用比当前运算符高一级的优先级来调用parsePrecedence()。
 	TokenType operatorType = parser.previous.type;
 	ParseRule* rule = getRule(operatorType);
+	// 在编译右操作数之前，我们记下左操作数是不是一条单独的常量指令。
+	int leftStart = current->lastConstant;
+	Value left = current->lastConstantValue;
+	int rightStart = currentChunk()->count;
 	parsePrecedence((Precedence)(rule->precedence + 1));
 
+	// 如果左右两个操作数都是常量，并且右操作数恰好紧跟在左操作数之后，就尝试折叠。
+	// 任何跳转的回填都会重置lastConstant，所以不会有跳转落在两个操作数之间。
+	if (leftStart != -1 && current->lastConstant == rightStart) {
+		Value result;
+		if (foldBinary(operatorType, left, current->lastConstantValue, &result)) {
+			discardConstants(leftStart);
+			emitValue(result);
+			return;
+		}
+	}
+
 	// 然后我们使用binary()来处理算术操作符的其余部分。
 	// 这个函数会编译右边的操作数，就像unary()编译自己的尾操作数那样。最后，它会发出执行对应二元运算的字节码指令。
 	// 当运行时，虚拟机会按顺序执行左、右操作数的代码，将它们的值留在栈上。然后它会执行操作符的指令。
@@ -369,10 +512,11 @@ static void binary(bool canAssign) {
 
 static void literal(bool canAssign) {
 	// 因为parsePrecedence()已经消耗了关键字标识，我们需要做的就是输出正确的指令。我们根据解析出的标识的类型来确定指令。
+	// 它们都是常量，所以我们用emitValue()生成它们，以便常量折叠能够识别。
 	switch (parser.previous.type) {
-	case TOKEN_FALSE: emitByte(OP_FALSE); break;
-	case TOKEN_NIL: emitByte(OP_NIL); break;
-	case TOKEN_TRUE: emitByte(OP_TRUE); break;
+	case TOKEN_FALSE: emitValue(BOOL_VAL(false)); break;
+	case TOKEN_NIL: emitValue(NIL_VAL); break;
+	case TOKEN_TRUE: emitValue(BOOL_VAL(true)); break;
 	default: return; // Unreachable.
 	}
 }
@@ -390,9 +534,23 @@ static void expression() {
 	parsePrecedence(PREC_ASSIGNMENT);
 }
 
-// 这个函数接受给定的标识，并将其词素作为一个字符串添加到字节码块的常量表中。然后，它会返回该常量在常量表中的索引。
-static uint8_t identifierConstant(Token* name) {
-	return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+// 字符串字面量和变量名的字节来自源代码。如果源代码交给了虚拟机保管，新字符串就直接借用这些字节，否则我们必须复制它们，因为调用者可能会在编译之后释放源代码。
+static ObjString* lexemeString(const char* start, int length) {
+	if (isRetainedSource(start)) return borrowString(start, length);
+	return copyString(start, length);
+}
+
+// 这个函数返回给定名称的全局变量在虚拟机全局变量数组中的槽号。
+// 每个全局变量名在第一次出现时（无论是声明、读取还是赋值）就会分配一个槽，之后同名的引用都会得到同一个槽号，
+// 所以运行时不需要再按名称查找哈希表。新的槽被初始化为“未定义”哨兵值，以便在变量被定义之前访问它时，虚拟机仍然能报告错误。
+// 名称到槽号的映射保存在vm.globals中，并且在多次interpret()调用之间一直存在，所以REPL中后输入的代码也能找到之前定义的变量。
+static uint16_t globalSlot(Token* name) {
+	int slot = declareGlobal(lexemeString(name->start, name->length));
+	if (slot == -1) {
+		error("Too many global variables.");
+		return 0;
+	}
+	return (uint16_t)slot;
 }
  
 static bool identifiersEqual(Token* a, Token* b) {
@@ -444,15 +602,15 @@ static void declareVariable() {
 	addLocal(*name);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
+static uint16_t parseVariable(const char* errorMessage) {
 	consume(TOKEN_IDENTIFIER, errorMessage);
 
 	// 首先，我们“声明”这个变量。之后，如果我们在局部作用域中，则退出函数。
-	// 在运行时，不会通过名称查询局部变量。不需要将变量的名称放入常量表中，所以如果声明在局部作用域内，则返回一个假的表索引。
+	// 在运行时，不会通过名称查询局部变量。不需要为它分配全局变量槽，所以如果声明在局部作用域内，则返回一个假的槽号。
 	declareVariable();
 	if (current->scopeDepth > 0) return 0;
 
-	return identifierConstant(&parser.previous);
+	return globalSlot(&parser.previous);
 }
 
 // 所这就是编译器中“声明”和“定义”变量的真正含义。“声明”是指变量被添加到作用域中，而“定义”是变量可以被使用的时候。
@@ -460,10 +618,10 @@ static void markInitialized() {
 	current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-// 它会输出字节码指令，用于定义新变量并存储其初始化值。变量名在常量表中的索引是该指令的操作数。
+// 它会输出字节码指令，用于定义新变量并存储其初始化值。变量的全局槽号是该指令的操作数。
 // 在基于堆栈的虚拟机中，我们通常是最后发出这条指令。
 // 在运行时，我们首先执行变量初始化器的代码，将值留在栈中。然后这条指令会获取该值并保存起来，以供日后使用。
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
 	// 如果处于局部作用域内，就需要生成一个字节码来存储局部变量。
 	// 没有代码会在运行时创建局部变量。想想虚拟机现在处于什么状态。
 	// 它已经执行了变量初始化表达式的代码（如果用户省略了初始化，则是隐式的nil），并且该值作为唯一保留的临时变量位于栈顶。
@@ -474,15 +632,15 @@ static void defineVariable(uint8_t global) {
 		return;
 	}
 
-	emitBytes(OP_DEFINE_GLOBAL, global);
+	emitShortOperand(OP_DEFINE_GLOBAL, global);
 }
 
 // 变量声明的解析从varDeclaration()开始，并依赖于其它几个函数。
-// 首先，parseVariable()会使用标识符标识作为变量名称，将其词素作为字符串添加到字节码块的常量表中，然后返回它的常量表索引。
-// 接着，在varDeclaration()编译完初始化表达式后，会调用defineVariable()生成字节码，将变量的值存储到全局变量哈希表中。
+// 首先，parseVariable()会使用标识符标识作为变量名称，为它分配（或找到已有的）全局变量槽，然后返回槽号。
+// 接着，在varDeclaration()编译完初始化表达式后，会调用defineVariable()生成字节码，将变量的值存储到全局变量数组的对应槽中。
 static void varDeclaration() {
 	// 关键字后面跟着变量名。它是由parseVariable()编译的。
-	uint8_t global = parseVariable("Expect variable name.");
+	uint16_t global = parseVariable("Expect variable name.");
 
 	if (match(TOKEN_EQUAL)) {
 		// 然后我们会寻找一个=，后跟初始化表达式。
@@ -495,8 +653,7 @@ static void varDeclaration() {
 	consume(TOKEN_SEMICOLON,
 		"Expect ';' after variable declaration.");
 
-	// 全局变量在运行时是按名称查找的。这意味着虚拟机（字节码解释器循环）需要访问该名称。
-	// 整个字符串太大，不能作为操作数塞进字节码流中。相反，我们将字符串存储到常量表中，然后指令通过该名称在表中的索引来引用它。
+	// 全局变量在编译时就被解析为一个槽号，虚拟机在运行时直接用它索引全局变量数组，而不需要按名称查找。
 	defineVariable(global);
 }
 
@@ -647,6 +804,8 @@ static void patchJump(int offset) {
 
 	currentChunk()->code[offset] = (jump >> 8) & 0xff;
 	currentChunk()->code[offset + 1] = jump & 0xff;
+	// 跳转的目标就是当前位置，所以之前生成的常量不能再与之后的代码一起折叠。
+	current->lastConstant = -1;
 }
 
 static void ifStatement() {
@@ -740,6 +899,8 @@ static void endScope() {
 	// 当我们弹出一个作用域时，后向遍历局部变量数组，查找在刚刚离开的作用域深度上声明的所有变量。我们通过简单地递减数组长度来丢弃它们。
 	// 这里也有一个运行时的因素。局部变量占用了堆栈中的槽位。当局部变量退出作用域时，这个槽就不再需要了，应该被释放。
 	// 因此，对于我们丢弃的每一个变量，我们也要生成一条OP_POP指令，将其从栈中弹出。
+	// 先回到外层的作用域深度，这样比它更深的变量就是刚刚离开的块中声明的。
+	current->scopeDepth--;
 	while (current->localCount > 0 && current->locals[current->localCount - 1].depth > current->scopeDepth) {
 		emitByte(OP_POP);
 		current->localCount--;
@@ -790,7 +951,7 @@ static void number(bool canAssign) {
 
 static void string(bool canAssign) {
 	// 这里直接从词素中获取字符串的字符。+1和-2部分去除了开头和结尾的引号。然后，它创建了一个字符串对象，将其包装为一个Value，并塞入常量表中。
-	emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2)));
+	emitConstant(OBJ_VAL(lexemeString(parser.previous.start + 1, parser.previous.length - 2)));
 }
 
 static int resolveLocal(Compiler* compiler, Token* name) {
@@ -815,8 +976,8 @@ static int resolveLocal(Compiler* compiler, Token* name) {
 	return -1;
 }
 
-// 这里会调用与之前相同的identifierConstant()函数，以获取给定的标识符标识，并将其词素作为字符串添加到字节码块的常量表中。
-// 剩下的工作就是生成一条指令，加载具有该名称的全局变量。
+// 这里会调用与之前相同的globalSlot()函数，以获取给定名称的全局变量槽号。
+// 剩下的工作就是生成一条指令，加载该槽中的全局变量。
 static void namedVariable(Token name, bool canAssign) {
 	// 我们不对变量访问和赋值对应的字节码指令进行硬编码，而是使用了一些C变量。
 	// 首先，我们尝试查找具有给定名称的局部变量，如果我们找到了，就使用处理局部变量的指令。
@@ -828,19 +989,24 @@ static void namedVariable(Token name, bool canAssign) {
 		setOp = OP_SET_LOCAL;
 	}
 	else {
-		arg = identifierConstant(&name);
+		arg = globalSlot(&name);
 		getOp = OP_GET_GLOBAL;
 		setOp = OP_SET_GLOBAL;
 	}
 
 	// 在标识符表达式的解析函数中，我们会查找标识符后面的等号。
 	// 如果找到了，我们就不会生成变量访问的代码，我们会编译所赋的值，然后生成一个赋值指令。
+	// 局部变量的槽号是单字节操作数，而全局变量的槽号是16位的。
+	uint8_t op = getOp;
 	if (canAssign && match(TOKEN_EQUAL)) {
 		expression();
-		emitBytes(setOp, (uint8_t)arg);
+		op = setOp;
+	}
+	if (op == OP_GET_LOCAL || op == OP_SET_LOCAL) {
+		emitBytes(op, (uint8_t)arg);
 	}
 	else {
-		emitBytes(getOp, (uint8_t)arg);
+		emitShortOperand(op, (uint16_t)arg);
 	}
 }
 
@@ -854,8 +1020,19 @@ static void unary(bool canAssign) {
 
 	// 我们使用一元运算符本身的PREC_UNARY优先级来允许嵌套的一元表达式。
 	// 因为一元运算符的优先级很高，所以正确地排除了二元运算符之类的东西。
+	int operandStart = currentChunk()->count;
 	parsePrecedence(PREC_UNARY);
 
+	// 如果操作数是一条单独的常量指令，就尝试在编译时计算结果。
+	if (current->lastConstant == operandStart) {
+		Value result;
+		if (foldUnary(operatorType, current->lastConstantValue, &result)) {
+			discardConstants(operandStart);
+			emitValue(result);
+			return;
+		}
+	}
+
 	// 之后，我们发出字节码执行取负运算。
 	switch (operatorType) {
 	case TOKEN_BANG: emitByte(OP_NOT); break;
@@ -930,8 +1107,11 @@ static ParseRule* getRule(TokenType type) {
 ObjFunction* compile(const char* source, Chunk* chunk) {
 	initScanner(source);
 
-	Compiler compiler;
-	initCompiler(&compiler, TYPE_SCRIPT);
+	// 只在编译期间使用的数据都放在竞技场中：Compiler本身，以及窥孔优化的临时数组。编译结束时它们一次性全部释放。
+	// 字节码块不在其中，它们在编译之后还要继续存在。
+	initArena(&compileArena);
+	Compiler* compiler = ARENA_ALLOCATE(&compileArena, Compiler, 1);
+	initCompiler(compiler, TYPE_SCRIPT);
 
 	compilingChunk = chunk;
 
@@ -946,9 +1126,21 @@ ObjFunction* compile(const char* source, Chunk* chunk) {
 		declaration();
 	}
 
-	endCompiler();
-
 	// 我们从编译器获取函数对象。如果没有编译错误，就返回它。否则，我们通过返回NULL表示错误。这样，虚拟机就不会试图执行可能包含无效字节码的函数。
 	ObjFunction* function = endCompiler();
+	// 字节码块的最终大小已经确定了，去掉增长时多留的容量。
+	shrinkChunk(currentChunk());
+	// 编译已经结束，之后的垃圾回收不应该再通过current访问这个即将失效的Compiler。
+	current = NULL;
+	freeArena(&compileArena);
 	return parser.hadError ? NULL : function;
+}
+
+void markCompilerRoots() {
+	if (current == NULL) return;
+	markObject((Obj*)current->function);
+	ValueArray* constants = &currentChunk()->constants;
+	for (int i = 0; i < constants->count; i++) {
+		markValue(constants->values[i]);
+	}
 }
\ No newline at end of file
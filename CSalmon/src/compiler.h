@@ -4,6 +4,13 @@
 #include "object.h"
 #include "vm.h"
 
-ObjFunction* compile(const char* source);
+// 编译器的版本号。即使文件格式没有变化，只要编译器为同样的源代码生成的字节码发生了变化（例如新的优化），就必须增加它，
+// 这样编译缓存中用旧编译器生成的结果就会自动失效。
+#define COMPILER_VERSION 2
+
+// 把source编译到chunk中。有编译错误时返回NULL，这时chunk中的字节码不能执行。
+ObjFunction* compile(const char* source, Chunk* chunk);
+// 编译期间创建的函数对象和常量还没有被虚拟机的任何部分引用，垃圾回收器通过这个函数把它们当作根。
+void markCompilerRoots();
 
 #endif
\ No newline at end of file
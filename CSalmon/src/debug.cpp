@@ -1,7 +1,9 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "serializer.h"
 #include "value.h"
+#include "vm.h"
 
 // 要反汇编一个字节码块，我们首先打印一个小标题（这样我们就知道正在看哪个字节码块），然后通过字节码反汇编每个指令。
 void disassembleChunk(Chunk* chunk, const char* name) {
@@ -13,10 +15,13 @@ void disassembleChunk(Chunk* chunk, const char* name) {
 	}
 }
 
+// 从.salc文件载入的块中，还没有被执行到的字符串常量是UNDEFINED_VAL。我们像虚拟机一样先用loadConstant()驻留它，这样打印出来的是字符串本身。
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
 	uint8_t constant = chunk->code[offset + 1];
 	printf("%-16s %4d '", name, constant);
-	printValue(chunk->constants.values[constant]);
+	Value value = chunk->constants.values[constant];
+	if (IS_UNDEFINED(value) && chunk->image != NULL) value = loadConstant(chunk, constant);
+	printValue(value);
 	printf("'\n");
 	return offset + 2;
 }
@@ -34,6 +39,24 @@ static int byteInstruction(const char* name, Chunk* chunk, int offset) {
 	return offset + 2;
 }
 
+// OP_ADD_LOCALS有两个单字节的槽号操作数。
+static int twoByteInstruction(const char* name, Chunk* chunk, int offset) {
+	uint8_t a = chunk->code[offset + 1];
+	uint8_t b = chunk->code[offset + 2];
+	printf("%-16s %4d %4d\n", name, a, b);
+	return offset + 3;
+}
+
+// 全局变量指令有一个16位的槽号操作数。我们从虚拟机的全局变量名数组中找到对应的名称，一起打印出来。
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+	uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+	slot |= chunk->code[offset + 2];
+	printf("%-16s %4d '", name, slot);
+	printValue(vm.globalNames.values[slot]);
+	printf("'\n");
+	return offset + 3;
+}
+
 // 这两条指令具有新格式，有着16位的操作数，因此我们添加了一个新的工具函数来反汇编它们。
 static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
 	uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
@@ -46,11 +69,12 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 	// 首先，它会打印给定指令的字节偏移量——这能告诉我们当前指令在字节码块中的位置。当我们在字节码中实现控制流和跳转时，这将是一个有用的路标。
 	printf("%04d ", offset);
 
-	if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+	int line = getLine(chunk, offset);
+	if (offset > 0 && line == getLine(chunk, offset - 1)) {
 		printf("   | ");
 	}
 	else {
-		printf("%4d ", chunk->lines[offset]);
+		printf("%4d ", line);
 	}
 
 	// 接下来，它从字节码中的给定偏移量处读取一个字节。这也就是我们的操作码。
@@ -73,11 +97,11 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 	case OP_SET_LOCAL:
 		return byteInstruction("OP_SET_LOCAL", chunk, offset);
 	case OP_GET_GLOBAL:
-		return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+		return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 	case OP_SET_GLOBAL:
-		return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+		return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 	case OP_DEFINE_GLOBAL:
-		return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+		return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 	case OP_EQUAL:
 		return simpleInstruction("OP_EQUAL", offset);
 	case OP_GREATER:
@@ -106,9 +130,48 @@ int disassembleInstruction(Chunk* chunk, int offset) {
 		return jumpInstruction("OP_LOOP", -1, chunk, offset);
 	case OP_RETURN:
 		return simpleInstruction("OP_RETURN", offset);
+	case OP_ADD_LOCALS:
+		return twoByteInstruction("OP_ADD_LOCALS", chunk, offset);
+	case OP_LESS_JUMP_IF_FALSE:
+		return jumpInstruction("OP_LESS_JUMP_IF_FALSE", 1, chunk, offset);
+	case OP_ADD_CONSTANT:
+		return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
 		// 如果给定的字节看起来根本不像一条指令——这是我们编译器的一个错误——我们也要打印出来。
 	default:
 		printf("Unknown opcode %d\n", instruction);
 		return offset + 1;
 	}
+}
+
+const char* opcodeName(uint8_t instruction) {
+	switch (instruction) {
+	case OP_CONSTANT: return "OP_CONSTANT";
+	case OP_NIL: return "OP_NIL";
+	case OP_TRUE: return "OP_TRUE";
+	case OP_FALSE: return "OP_FALSE";
+	case OP_POP: return "OP_POP";
+	case OP_GET_LOCAL: return "OP_GET_LOCAL";
+	case OP_SET_LOCAL: return "OP_SET_LOCAL";
+	case OP_GET_GLOBAL: return "OP_GET_GLOBAL";
+	case OP_SET_GLOBAL: return "OP_SET_GLOBAL";
+	case OP_DEFINE_GLOBAL: return "OP_DEFINE_GLOBAL";
+	case OP_EQUAL: return "OP_EQUAL";
+	case OP_GREATER: return "OP_GREATER";
+	case OP_LESS: return "OP_LESS";
+	case OP_ADD: return "OP_ADD";
+	case OP_SUBTRACT: return "OP_SUBTRACT";
+	case OP_MULTIPLY: return "OP_MULTIPLY";
+	case OP_DIVIDE: return "OP_DIVIDE";
+	case OP_NOT: return "OP_NOT";
+	case OP_NEGATE: return "OP_NEGATE";
+	case OP_PRINT: return "OP_PRINT";
+	case OP_JUMP: return "OP_JUMP";
+	case OP_JUMP_IF_FALSE: return "OP_JUMP_IF_FALSE";
+	case OP_LOOP: return "OP_LOOP";
+	case OP_RETURN: return "OP_RETURN";
+	case OP_ADD_LOCALS: return "OP_ADD_LOCALS";
+	case OP_LESS_JUMP_IF_FALSE: return "OP_LESS_JUMP_IF_FALSE";
+	case OP_ADD_CONSTANT: return "OP_ADD_CONSTANT";
+	default: return "OP_UNKNOWN";
+	}
 }
\ No newline at end of file
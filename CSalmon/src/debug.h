@@ -7,5 +7,7 @@
 void disassembleChunk(Chunk* chunk, const char* name);
 // 这是用另一个函数实现的，该函数只反汇编一条指令。
 int disassembleInstruction(Chunk* chunk, int offset);
+// 返回操作码的名称，例如"OP_ADD"。
+const char* opcodeName(uint8_t instruction);
 
 #endif
\ No newline at end of file
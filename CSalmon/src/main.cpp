@@ -6,10 +6,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "chunk.h"
+#include "cache.h"
 #include "debug.h"
+#include "memory.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "scanner.h"
+#include "serializer.h"
 #include "vm.h"
 
 // 一个高质量的REPL可以优雅地处理多行的输入，并且没有硬编码的行长度限制。这里的REPL有点……简朴，但足以满足我们的需求。
@@ -23,8 +30,14 @@ static void repl() {
 			break;
 		}
 
+		// 之前输入的行中定义的变量名和字符串会一直存活，所以每一行都复制一份交给虚拟机保管，而不是直接使用会被下一行覆盖的缓冲区。
+		size_t length = strlen(line);
+		char* source = (char*)malloc(length + 1);
+		memcpy(source, line, length + 1);
+		retainSource(source);
+
 		// 真正的工作发生在interpret()中。
-		interpret(line);
+		interpret(source);
 	}
 }
 
@@ -63,33 +76,225 @@ static char* readFile(const char* path) {
 }
 
 // 我们读取文件并执行生成的Lox源码字符串。然后，根据其结果，我们适当地设置退出码，因为我们是严谨的工具制作者，并且关心这样的小细节。
-// 我们还需要释放源代码字符串，因为readFile()会动态地分配内存，并将所有权传递给它的调用者。
-static void runFile(const char* path) {
+// readFile()会动态地分配内存，并将所有权传递给它的调用者。我们把源代码交给虚拟机保管，这样字符串字面量和变量名可以直接借用其中的字节，虚拟机关闭时会释放它。
+// 下面几个函数都返回进程的退出码，而不是直接调用exit()，这样即使脚本出错，main()也会打印统计报告并关闭虚拟机。
+static int runFile(const char* path) {
 	char* source = readFile(path);
+	retainSource(source);
 	InterpretResult result = interpret(source);
+
+	if (result == INTERPRET_COMPILE_ERROR) return 65;
+	if (result == INTERPRET_RUNTIME_ERROR) return 70;
+	return 0;
+}
+
+// 使用编译缓存运行脚本。缓存目录无法使用时，我们退回到普通的runFile()，这样缓存出了问题也不会影响脚本的运行。
+static int runFileCached(const char* path, const char* cacheDir, size_t cacheBytes) {
+	char* source = readFile(path);
+	BytecodeImage image;
+	CacheResult cached = loadCachedBytecode(cacheDir, cacheBytes, source, &image);
+	free(source);
+
+	if (cached == CACHE_COMPILE_ERROR) return 65;
+	if (cached == CACHE_UNAVAILABLE) return runFile(path);
+
+	InterpretResult result = interpretChunk(&image.chunk);
+	unloadBytecodeFile(&image);
+
+	if (result == INTERPRET_RUNTIME_ERROR) return 70;
+	return 0;
+}
+
+// 以.salc结尾的路径是预先编译好的字节码文件。我们把它映射到内存中直接执行，完全跳过扫描和编译。
+static bool isBytecodeFile(const char* path) {
+	size_t length = strlen(path);
+	return length > 5 && strcmp(path + length - 5, ".salc") == 0;
+}
+
+static int runBytecodeFile(const char* path) {
+	BytecodeImage image;
+	LoadResult loaded = loadBytecodeFile(path, &image, false);
+	if (loaded == LOAD_IO_ERROR) return 74;
+	if (loaded == LOAD_INVALID) return 65;
+
+	InterpretResult result = interpretChunk(&image.chunk);
+	unloadBytecodeFile(&image);
+
+	if (result == INTERPRET_RUNTIME_ERROR) return 70;
+	return 0;
+}
+
+// --compile-only只编译脚本，把字节码写入-o指定的文件，而不执行它。
+static int compileFile(const char* path, const char* output) {
+	char* source = readFile(path);
+	InterpretResult result = compileToFile(source, output);
+	free(source);
+
+	if (result == INTERPRET_COMPILE_ERROR) return 65;
+	if (result == INTERPRET_RUNTIME_ERROR) return 74;
+	return 0;
+}
+
+// --bench-scanner只扫描脚本而不编译它，用来衡量扫描器的吞吐量。为了得到稳定的计时，它会反复扫描整个文件至少一秒钟。
+// 它同时打印词法标识的数量和一个由每个标识的位置、类型、长度和行号算出的校验和，用来确认不同的扫描实现（SIMD或逐字节）产生了完全相同的标识。
+static void benchScanner(const char* path) {
+	char* source = readFile(path);
+	size_t length = strlen(source);
+
+	int passes = 0;
+	int tokens = 0;
+	uint64_t checksum = 0;
+	clock_t start = clock();
+	clock_t elapsed;
+	do {
+		initScanner(source);
+		tokens = 0;
+		checksum = 14695981039346656037ull;
+		for (;;) {
+			Token token = scanToken();
+			tokens++;
+			// 错误标识的词素是一条错误信息，而不是源代码的一部分，所以它没有位置。
+			uint64_t offset = token.type == TOKEN_ERROR ? 0 : (uint64_t)(token.start - source);
+			uint64_t fields[] = { offset, (uint64_t)token.type, (uint64_t)token.length, (uint64_t)token.line };
+			for (int i = 0; i < 4; i++) {
+				checksum ^= fields[i];
+				checksum *= 1099511628211ull;
+			}
+			if (token.type == TOKEN_EOF) break;
+		}
+		passes++;
+		elapsed = clock() - start;
+	} while (elapsed < CLOCKS_PER_SEC);
+
+	double seconds = (double)elapsed / CLOCKS_PER_SEC;
+	double megabytes = (double)length * passes / (1024.0 * 1024.0);
+	printf("scanned %zu bytes x %d passes, %d tokens per pass (checksum %016llx)\n",
+		length, passes, tokens, (unsigned long long)checksum);
+	printf("%.1f MB/s\n", megabytes / seconds);
 	free(source);
+}
 
-	if (result == INTERPRET_COMPILE_ERROR) exit(65);
-	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+// 统计报告写到stderr，这样它不会和脚本自己的输出混在一起。
+static void printStats() {
+	// 先冲刷标准输出，让报告总是出现在脚本输出之后。
+	fflush(stdout);
+	fprintf(stderr, "-- stats --\n");
+	fprintf(stderr, "dispatches: %llu\n", (unsigned long long)vm.dispatchCount);
+	// 行号表使用游程编码。作为对照，我们同时给出为每个字节存储一个int行号时需要的内存。
+	fprintf(stderr, "bytecode:   %zu bytes\n", vm.codeBytes);
+	fprintf(stderr, "line table: %zu bytes (%zu bytes unencoded)\n", vm.lineTableBytes, vm.codeBytes * sizeof(int));
+	fprintf(stderr, "peephole:   %s\n", vm.peephole ? "on" : "off");
+	fprintf(stderr, "cache:      %d hits, %d misses, %d evictions\n", vm.cacheHits, vm.cacheMisses, vm.cacheEvictions);
+	fprintf(stderr, "gc:         %d minor, %d major collections\n", vm.minorCollections, vm.majorCollections);
+	printAllocatorStats();
 }
 
+static void usage() {
+	fprintf(stderr, "Usage: clox [--trace] [--dump-bytecode] [--stats] [--no-peephole] [--stress-gc] [--profile] [--sample-profile file] [--mem-stats] [path]\n");
+	fprintf(stderr, "       clox --compile-only -o file.salc path\n");
+	fprintf(stderr, "       clox --cache-dir dir [--cache-size megabytes] path\n");
+	fprintf(stderr, "       clox --bench-scanner path\n");
+	exit(64);
+}
 
 int main(int argc, const char* argv[]) {
 	initVM();
 
-	// 如果你没有向可执行文件传递任何参数，就会进入REPL。
-	if (argc == 1) {
+	// 以“--”开头的参数是调试标志，它们可以出现在脚本路径之前或之后。剩下的那个参数（如果有的话）就是要运行的脚本的路径。
+	// --trace让虚拟机在执行每条指令之前反汇编并打印它以及栈的内容，--dump-bytecode在每次编译之后打印整个字节码块。
+	// --stats在退出时打印解释器的运行统计，--no-peephole关闭窥孔优化，便于比较优化前后的字节码和分派次数。
+	// --stress-gc让每次分配内存都触发一次垃圾回收，用来测试回收器是否找到了所有的根。
+	// --profile在退出时报告每个操作码的执行次数和平均耗时，以及最常见的相邻操作码对。
+	// --sample-profile定期抽样脚本正在执行的源代码行，退出时把结果以火焰图工具使用的折叠栈格式写入给定的文件。
+	// --mem-stats在退出时按用途（字符串、函数、字节码、行号表、常量表、哈希表、驻留表等）报告存活的内存、峰值和分配次数。
+	// --compile-only和-o一起使用，把脚本编译成.salc文件。之后把.salc文件的路径传给clox就可以直接执行它。
+	// --cache-dir打开编译缓存，--cache-size设置缓存目录的大小上限（以MB为单位）。
+	// --bench-scanner只扫描脚本，报告扫描器的吞吐量。
+	const char* path = NULL;
+	const char* output = NULL;
+	bool compileOnly = false;
+	bool scanOnly = false;
+	const char* cacheDir = NULL;
+	const char* sampleOutput = NULL;
+	size_t cacheBytes = CACHE_DEFAULT_MAX_BYTES;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--trace") == 0) {
+			vm.traceExecution = true;
+		}
+		else if (strcmp(argv[i], "--dump-bytecode") == 0) {
+			vm.printCode = true;
+		}
+		else if (strcmp(argv[i], "--stats") == 0) {
+			vm.printStats = true;
+		}
+		else if (strcmp(argv[i], "--no-peephole") == 0) {
+			vm.peephole = false;
+		}
+		else if (strcmp(argv[i], "--stress-gc") == 0) {
+			vm.stressGC = true;
+		}
+		else if (strcmp(argv[i], "--profile") == 0) {
+			vm.profile = true;
+		}
+		else if (strcmp(argv[i], "--mem-stats") == 0) {
+			vm.printMemoryStats = true;
+		}
+		else if (strcmp(argv[i], "--compile-only") == 0) {
+			compileOnly = true;
+		}
+		else if (strcmp(argv[i], "--bench-scanner") == 0) {
+			scanOnly = true;
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		}
+		else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+			sampleOutput = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+			cacheDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+			cacheBytes = (size_t)strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+		}
+		else if (argv[i][0] != '-' && path == NULL) {
+			path = argv[i];
+		}
+		else {
+			usage();
+		}
+	}
+	if (compileOnly != (output != NULL) || (compileOnly && path == NULL)) usage();
+	if (scanOnly && (path == NULL || compileOnly)) usage();
+	if (sampleOutput != NULL) vm.sampling = initSampler();
+
+	// 如果你没有向可执行文件传递脚本路径，就会进入REPL。否则，就将其当做要运行的脚本的路径。
+	int status = 0;
+	if (path == NULL) {
 		repl();
 	}
-	// 如果传入一个参数，就将其当做要运行的脚本的路径。
-	else if (argc == 2) {
-		runFile(argv[1]);
+	else if (scanOnly) {
+		benchScanner(path);
+	}
+	else if (compileOnly) {
+		status = compileFile(path, output);
+	}
+	else if (isBytecodeFile(path)) {
+		status = runBytecodeFile(path);
+	}
+	else if (cacheDir != NULL) {
+		status = runFileCached(path, cacheDir, cacheBytes);
 	}
 	else {
-		fprintf(stderr, "Usage: clox [path]\n");
-		exit(64);
+		status = runFile(path);
 	}
 
+	if (vm.printStats) printStats();
+	if (vm.profile) printProfile();
+	if (vm.sampling) {
+		writeSamples(sampleOutput);
+		freeSampler();
+	}
 	freeVM();
-	return 0;
+	return status;
 }
\ No newline at end of file
@@ -1,9 +1,15 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "compiler.h"
 #include "memory.h"
 #include "vm.h"
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+// 年轻对象在新生代中按8字节对齐。
+#define NURSERY_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+static void* systemReallocate(void* pointer, size_t newSize) {
     // 当newSize为0时，我们通过调用free()来自己处理回收的情况。
     if (newSize == 0) {
         free(pointer);
@@ -24,6 +30,197 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     return result;
 }
 
+#ifdef POOL_ALLOCATOR
+// ------------------分级内存池------------------
+// 虚拟机分配的绝大多数内存块都很小：字符串和函数对象、ObjBuilder的缓冲区描述、刚开始增长的数组。对它们来说，malloc()的通用逻辑（加锁、查找合适的空闲块、合并相邻的块）都是多余的开销。
+// 所以不超过POOL_MAX_SIZE字节的块按大小向上取整到POOL_GRANULE的倍数，每个大小级别有自己的空闲链表。
+// 分配时先从空闲链表中取一块；链表为空时，从这个级别当前的内存页中切下一块；内存页也用完了，再向系统申请一个新的页。释放时只需把块放回链表。
+// 调用reallocate()时总会给出块原来的大小，所以我们不需要在块前面保存任何头信息，就知道它属于哪个级别。更大的块仍然交给系统的realloc()。
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULE)
+#define POOL_PAGE_SIZE (64 * 1024)
+
+// 空闲的块用它开头的几个字节把自己链接到空闲链表中。
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+// 从系统申请的内存页用一个链表串起来，关闭虚拟机时一起释放。页头占用第一个POOL_GRANULE字节，这样后面的块仍然是对齐的。
+typedef struct Page {
+    struct Page* next;
+} Page;
+
+typedef struct {
+    FreeBlock* freeList;
+    // 当前页中还没有被切分的部分。
+    char* cursor;
+    char* limit;
+    uint64_t allocations;
+    size_t live;
+    size_t peak;
+} SizeClass;
+
+static SizeClass sizeClasses[POOL_CLASS_COUNT];
+static Page* pages = NULL;
+static int pageCount = 0;
+static uint64_t largeAllocations = 0;
+
+static int sizeClassOf(size_t size) {
+    return (int)((size + POOL_GRANULE - 1) / POOL_GRANULE) - 1;
+}
+
+static void* poolAllocate(int index) {
+    SizeClass* sizeClass = &sizeClasses[index];
+    sizeClass->allocations++;
+    if (++sizeClass->live > sizeClass->peak) sizeClass->peak = sizeClass->live;
+
+    if (sizeClass->freeList != NULL) {
+        FreeBlock* block = sizeClass->freeList;
+        sizeClass->freeList = block->next;
+        return block;
+    }
+
+    size_t blockSize = (size_t)(index + 1) * POOL_GRANULE;
+    if ((size_t)(sizeClass->limit - sizeClass->cursor) < blockSize) {
+        Page* page = (Page*)malloc(POOL_PAGE_SIZE);
+        if (page == NULL) exit(1);
+        page->next = pages;
+        pages = page;
+        pageCount++;
+        sizeClass->cursor = (char*)page + POOL_GRANULE;
+        sizeClass->limit = (char*)page + POOL_PAGE_SIZE;
+    }
+    void* block = sizeClass->cursor;
+    sizeClass->cursor += blockSize;
+    return block;
+}
+
+static void poolFree(void* pointer, int index) {
+    SizeClass* sizeClass = &sizeClasses[index];
+    FreeBlock* block = (FreeBlock*)pointer;
+    block->next = sizeClass->freeList;
+    sizeClass->freeList = block;
+    sizeClass->live--;
+}
+
+static void* poolReallocate(void* pointer, size_t oldSize, size_t newSize) {
+    bool oldSmall = pointer != NULL && oldSize <= POOL_MAX_SIZE;
+    bool newSmall = newSize != 0 && newSize <= POOL_MAX_SIZE;
+
+    // 大小还在同一个级别中（数组的增长经常如此），块本身就已经足够了。
+    if (oldSmall && newSmall && sizeClassOf(oldSize) == sizeClassOf(newSize)) return pointer;
+    // 两边都不是池中的块，这完全是系统分配器的事情。
+    if (!oldSmall && !newSmall) {
+        if (pointer == NULL && newSize != 0) largeAllocations++;
+        return systemReallocate(pointer, newSize);
+    }
+
+    // 块要在内存池和系统分配器之间（或者池中不同的级别之间）搬家：分配新块，复制内容，再释放旧块。
+    void* result = NULL;
+    if (newSize != 0) {
+        if (newSmall) {
+            result = poolAllocate(sizeClassOf(newSize));
+        }
+        else {
+            largeAllocations++;
+            result = systemReallocate(NULL, newSize);
+        }
+        if (pointer != NULL) memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+    if (pointer != NULL) {
+        if (oldSmall) {
+            poolFree(pointer, sizeClassOf(oldSize));
+        }
+        else {
+            free(pointer);
+        }
+    }
+    return result;
+}
+
+void printAllocatorStats() {
+    fprintf(stderr, "allocator:  size-class pool, %d pages of %d KB, %llu large allocations\n",
+        pageCount, POOL_PAGE_SIZE / 1024, (unsigned long long)largeAllocations);
+    for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+        SizeClass* sizeClass = &sizeClasses[i];
+        if (sizeClass->allocations == 0) continue;
+        fprintf(stderr, "  %3d bytes: %10llu allocations, %8zu live, %8zu peak\n",
+            (i + 1) * POOL_GRANULE, (unsigned long long)sizeClass->allocations, sizeClass->live, sizeClass->peak);
+    }
+}
+
+void freeAllocator() {
+    while (pages != NULL) {
+        Page* next = pages->next;
+        free(pages);
+        pages = next;
+    }
+    pageCount = 0;
+    memset(sizeClasses, 0, sizeof(sizeClasses));
+}
+#else
+void printAllocatorStats() {
+    fprintf(stderr, "allocator:  system\n");
+}
+
+void freeAllocator() {
+}
+#endif
+
+// reallocate()中真正分配内存的部分。次要回收把对象复制到老年代时也使用它，因为回收过程中不能再触发回收。
+static void* reallocateRaw(MemoryCategory category, void* pointer, size_t oldSize, size_t newSize) {
+    vm.bytesAllocated += newSize - oldSize;
+    MemoryStats* stats = &vm.memory[category];
+    stats->live += newSize - oldSize;
+    if (newSize > oldSize) {
+        if (pointer == NULL) stats->allocations++;
+        if (stats->live > stats->peak) stats->peak = stats->live;
+        if (vm.bytesAllocated > vm.peakBytesAllocated) vm.peakBytesAllocated = vm.bytesAllocated;
+    }
+#ifdef POOL_ALLOCATOR
+    return poolReallocate(pointer, oldSize, newSize);
+#else
+    return systemReallocate(pointer, newSize);
+#endif
+}
+
+void* reallocate(MemoryCategory category, void* pointer, size_t oldSize, size_t newSize) {
+    // 只有在分配更多内存时才考虑回收。释放内存时回收没有意义，而且清除阶段本身就在释放内存。
+    if (newSize > oldSize) {
+        if (vm.stressGC || vm.bytesAllocated + newSize - oldSize > vm.nextGC) collectGarbage();
+    }
+    return reallocateRaw(category, pointer, oldSize, newSize);
+}
+
+static const char* categoryNames[MEM_CATEGORY_COUNT] = {
+    "strings", "functions", "chunk code", "line tables", "constants", "tables", "interner", "globals", "compiler", "other",
+};
+
+// 年轻对象只有在晋升到老年代之后才计入统计，新生代本身是一块固定大小的内存，单独列出。
+void printMemoryStats() {
+    fflush(stdout);
+    fprintf(stderr, "-- memory --\n");
+    fprintf(stderr, "%-12s %12s %12s %12s\n", "category", "live", "peak", "allocations");
+    uint64_t allocations = 0;
+    for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+        MemoryStats* stats = &vm.memory[i];
+        allocations += stats->allocations;
+        fprintf(stderr, "%-12s %12zu %12zu %12llu\n", categoryNames[i], stats->live, stats->peak, (unsigned long long)stats->allocations);
+    }
+    // 各分类的峰值出现在不同的时刻，所以总的峰值单独记录，而不是把它们相加。
+    fprintf(stderr, "%-12s %12zu %12zu %12llu\n", "total", vm.bytesAllocated, vm.peakBytesAllocated, (unsigned long long)allocations);
+    fprintf(stderr, "%-12s %12d\n", "nursery", NURSERY_SIZE);
+}
+
+// 缓冲区由所有共享它的ObjBuilder共同拥有，最后一个被释放的ObjBuilder负责释放它。
+static void releaseBuffer(StringBuffer* buffer) {
+    if (--buffer->refs == 0) {
+        FREE_ARRAY(MEM_STRING, char, buffer->chars, buffer->capacity);
+        FREE(MEM_STRING, StringBuffer, buffer);
+    }
+}
+
 // 当我们使用完一个函数对象后，必须将它借用的比特位返还给操作系统。
 static void freeObject(Obj* object) {
     switch (object->type) {
@@ -31,20 +228,324 @@ static void freeObject(Obj* object) {
         // 这个switch语句负责释放ObjFunction本身以及它所占用的其它内存。函数拥有自己的字节码块，所以我们调用Chunk中类似析构器的函数。
         ObjFunction* function = (ObjFunction*)object;
         freeChunk(&function->chunk);
-        FREE(ObjFunction, object);
+        FREE(MEM_FUNCTION, ObjFunction, object);
         break;
     }
     case OBJ_STRING: {
+        // 字符就存放在ObjString的末尾，所以一次释放就够了，只是大小要按字符串的长度计算。借用的字符属于源代码，不由字符串释放。
         ObjString* string = (ObjString*)object;
-        // 我们不仅释放了Obj本身。因为有些对象类型还分配了它们所拥有的其它内存，我们还需要一些特定于类型的代码来处理每种对象类型的特殊需求。
-        // 在这里，这意味着我们释放字符数组，然后释放ObjString。它们都使用了最后一个内存管理宏。
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjString, object);
+        reallocate(MEM_STRING, object, IS_BORROWED(string) ? sizeof(ObjString) : STRING_SIZE(string->length), 0);
+        break;
+    }
+    case OBJ_BUILDER: {
+        releaseBuffer(((ObjBuilder*)object)->buffer);
+        FREE(MEM_STRING, ObjBuilder, object);
         break;
     }
     }
 }
 
+void markObject(Obj* object) {
+    if (object == NULL) return;
+    // 主要回收不会移动对象，也不会释放新生代中的对象，它们要等到下一次次要回收时再处理。年轻对象不引用其它对象，所以也不需要追踪它们。
+    if (isYoungObject(object)) return;
+    if (object->isMarked) return;
+    object->isMarked = true;
+
+    // 字符串和ObjBuilder不引用其它对象（ObjBuilder的缓冲区不是对象，由引用计数管理），标记之后就已经处理完了。
+    // 只有函数还需要追踪它的名称和常量，所以只有它们会进入灰色栈。
+    if (object->type != OBJ_FUNCTION) return;
+
+    if (vm.grayCapacity < vm.grayCount + 1) {
+        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+        vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
+        if (vm.grayStack == NULL) exit(1);
+    }
+    vm.grayStack[vm.grayCount++] = object;
+}
+
+void markValue(Value value) {
+    if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+static void markArray(ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        markValue(array->values[i]);
+    }
+}
+
+// 把一个灰色对象变黑：标记它引用的所有对象。
+static void blackenObject(Obj* object) {
+    ObjFunction* function = (ObjFunction*)object;
+    markObject((Obj*)function->name);
+    markArray(&function->chunk.constants);
+}
+
+static void markRoots() {
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        markValue(*slot);
+    }
+    // 全局变量的值和名称都按槽号保存，globals表的键也是这些名称。
+    markArray(&vm.globalValues);
+    markArray(&vm.globalNames);
+    markTable(&vm.globals);
+    markArray(&vm.hostRoots);
+    // 正在执行的块（可能是从.salc文件载入的）的常量不属于任何函数对象。
+    if (vm.chunk != NULL) markArray(&vm.chunk->constants);
+    markCompilerRoots();
+}
+
+static void traceReferences() {
+    while (vm.grayCount > 0) {
+        blackenObject(vm.grayStack[--vm.grayCount]);
+    }
+}
+
+static void sweep() {
+    Obj* previous = NULL;
+    Obj* object = vm.objects;
+    while (object != NULL) {
+        if (object->isMarked) {
+            object->isMarked = false;
+            previous = object;
+            object = object->next;
+        }
+        else {
+            Obj* unreached = object;
+            object = object->next;
+            if (previous != NULL) {
+                previous->next = object;
+            }
+            else {
+                vm.objects = object;
+            }
+            freeObject(unreached);
+        }
+    }
+}
+
+void collectGarbage() {
+    markRoots();
+    traceReferences();
+    tableRemoveWhite(&vm.strings);
+    sweep();
+    vm.majorCollections++;
+
+    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    if (vm.nextGC < GC_INITIAL_HEAP) vm.nextGC = GC_INITIAL_HEAP;
+}
+
+// ------------------新生代------------------
+// 几乎所有连接产生的字符串在几条指令之后就不再被引用了。这样的对象在新生代中分配：分配只是把nurseryTop向前移动，不需要调用realloc()，也不需要加入对象链表。
+// 新生代满了之后，次要回收把仍然存活的年轻对象复制到老年代（用reallocate()分配，加入对象链表，之后由标记-清除回收管理），然后整个新生代一次性清空。
+// 复制会改变对象的地址，所以次要回收必须找到所有引用年轻对象的地方并更新它们：虚拟机的栈，以及写屏障记录下来的老年代中的位置。
+// 因为复制会让C代码中的局部变量失效，次要回收只在concatenate()的开头进行，那时所有的字符串值都在虚拟机的栈上。
+// 其它时候新生代满了，分配就直接在老年代中进行，直到下一次次要回收。
+
+void* allocateYoung(size_t size) {
+    size = NURSERY_ALIGN(size);
+    if ((size_t)(vm.nurseryEnd - vm.nurseryTop) < size) {
+        vm.nurseryFull = true;
+        return NULL;
+    }
+    void* result = vm.nurseryTop;
+    vm.nurseryTop += size;
+    return result;
+}
+
+void releaseYoung(void* pointer, size_t size) {
+    // 只能收回最后一次分配。其它的对象留在原地，它们的对象头仍然完整，次要回收遍历新生代时会把它们当作死亡的对象跳过。
+    if ((char*)pointer + NURSERY_ALIGN(size) == vm.nurseryTop) vm.nurseryTop = (char*)pointer;
+}
+
+// 写屏障的记录用系统的realloc()管理，和灰色栈一样，扩展它们不会触发回收。
+void rememberSlot(ValueArray* array, int index) {
+    // 循环中反复给同一个变量赋值时，连续的记录往往是同一个位置。
+    if (vm.rememberedSlotCount > 0) {
+        RememberedSlot* last = &vm.rememberedSlots[vm.rememberedSlotCount - 1];
+        if (last->array == array && last->index == index) return;
+    }
+    if (vm.rememberedSlotCapacity < vm.rememberedSlotCount + 1) {
+        vm.rememberedSlotCapacity = GROW_CAPACITY(vm.rememberedSlotCapacity);
+        vm.rememberedSlots = (RememberedSlot*)realloc(vm.rememberedSlots, sizeof(RememberedSlot) * vm.rememberedSlotCapacity);
+        if (vm.rememberedSlots == NULL) exit(1);
+    }
+    vm.rememberedSlots[vm.rememberedSlotCount].array = array;
+    vm.rememberedSlots[vm.rememberedSlotCount].index = index;
+    vm.rememberedSlotCount++;
+}
+
+void rememberEntry(Table* table, ObjString* key) {
+    if (vm.rememberedEntryCapacity < vm.rememberedEntryCount + 1) {
+        vm.rememberedEntryCapacity = GROW_CAPACITY(vm.rememberedEntryCapacity);
+        vm.rememberedEntries = (RememberedEntry*)realloc(vm.rememberedEntries, sizeof(RememberedEntry) * vm.rememberedEntryCapacity);
+        if (vm.rememberedEntries == NULL) exit(1);
+    }
+    vm.rememberedEntries[vm.rememberedEntryCount].table = table;
+    vm.rememberedEntries[vm.rememberedEntryCount].key = key;
+    vm.rememberedEntryCount++;
+}
+
+void forgetArray(ValueArray* array) {
+    for (int i = vm.rememberedSlotCount - 1; i >= 0; i--) {
+        if (vm.rememberedSlots[i].array == array) vm.rememberedSlots[i] = vm.rememberedSlots[--vm.rememberedSlotCount];
+    }
+}
+
+void forgetTable(Table* table) {
+    for (int i = vm.rememberedEntryCount - 1; i >= 0; i--) {
+        if (vm.rememberedEntries[i].table == table) vm.rememberedEntries[i] = vm.rememberedEntries[--vm.rememberedEntryCount];
+    }
+}
+
+// 年轻对象只有字符串和ObjBuilder两种。年轻的字符串总是自己拥有字符。
+static size_t youngSize(Obj* object) {
+    if (object->type == OBJ_STRING) return STRING_SIZE(((ObjString*)object)->length);
+    return sizeof(ObjBuilder);
+}
+
+// 把一个存活的年轻对象复制到老年代，返回它的新地址。年轻对象不在对象链表中，next字段总是NULL，所以复制之后我们用它保存新地址（转发指针），
+// 再次遇到同一个对象时直接返回新地址。
+static Obj* promoteObject(Obj* object) {
+    if (object->next != NULL) return object->next;
+
+    size_t size = youngSize(object);
+    Obj* copy = (Obj*)reallocateRaw(MEM_STRING, NULL, 0, size);
+    memcpy(copy, object, size);
+    if (copy->type == OBJ_STRING) {
+        ObjString* string = (ObjString*)copy;
+        string->chars = string->storage;
+    }
+    copy->next = vm.objects;
+    vm.objects = copy;
+    object->next = copy;
+    return copy;
+}
+
+static void promoteValue(Value* slot) {
+    if (IS_YOUNG(*slot)) *slot = OBJ_VAL(promoteObject(AS_OBJ(*slot)));
+}
+
+// 没有被复制出去的ObjBuilder已经死亡，它们对共享缓冲区的引用必须释放。我们按分配的顺序遍历整个新生代来找到它们。
+static void releaseDeadYoung() {
+    for (char* p = vm.nurseryStart; p < vm.nurseryTop; p += NURSERY_ALIGN(youngSize((Obj*)p))) {
+        Obj* object = (Obj*)p;
+        if (object->type == OBJ_BUILDER && object->next == NULL) releaseBuffer(((ObjBuilder*)object)->buffer);
+    }
+}
+
+void collectNursery() {
+    // 根：虚拟机的栈、宿主持有的值，以及写屏障记录下来的老年代位置。年轻对象不引用其它对象，所以复制它们之后不需要继续追踪。
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        promoteValue(slot);
+    }
+    for (int i = 0; i < vm.hostRoots.count; i++) {
+        promoteValue(&vm.hostRoots.values[i]);
+    }
+    for (int i = 0; i < vm.rememberedSlotCount; i++) {
+        RememberedSlot* remembered = &vm.rememberedSlots[i];
+        // 记录下来之后，数组可能被截断了（例如常量折叠丢弃了末尾的常量）。
+        if (remembered->index < remembered->array->count) promoteValue(&remembered->array->values[remembered->index]);
+    }
+    for (int i = 0; i < vm.rememberedEntryCount; i++) {
+        RememberedEntry* remembered = &vm.rememberedEntries[i];
+        if (remembered->table == &vm.strings) continue;
+        // 条目可能已经被删除了，或者已经因为同一个键的另一条记录而更新过了，这时按原来的地址就找不到它。
+        Entry* entry = tableFindEntry(remembered->table, remembered->key);
+        if (entry == NULL) continue;
+        if (isYoungObject((Obj*)entry->key)) entry->key = (ObjString*)promoteObject((Obj*)entry->key);
+        promoteValue(&entry->value);
+    }
+
+    // 字符串表是弱引用的，所以要等所有存活的对象都复制完之后再处理它：被复制的字符串换成新地址，其余的年轻字符串已经死亡，从表中删除。
+    for (int i = 0; i < vm.rememberedEntryCount; i++) {
+        RememberedEntry* remembered = &vm.rememberedEntries[i];
+        if (remembered->table != &vm.strings) continue;
+        Entry* entry = tableFindEntry(&vm.strings, remembered->key);
+        if (entry == NULL || !isYoungObject((Obj*)entry->key)) continue;
+        if (entry->key->obj.next != NULL) {
+            entry->key = (ObjString*)entry->key->obj.next;
+        }
+        else {
+            tableDelete(&vm.strings, remembered->key);
+        }
+    }
+
+    releaseDeadYoung();
+    vm.nurseryTop = vm.nurseryStart;
+    vm.nurseryFull = false;
+    vm.rememberedSlotCount = 0;
+    vm.rememberedEntryCount = 0;
+    vm.minorCollections++;
+
+    // 复制出来的对象增加了老年代的大小，这时正是进行主要回收的安全时机。
+    if (vm.stressGC || vm.bytesAllocated > vm.nextGC) collectGarbage();
+}
+
+void freeNursery() {
+    releaseDeadYoung();
+    free(vm.nurseryStart);
+    free(vm.rememberedSlots);
+    free(vm.rememberedEntries);
+}
+
+// 竞技场中的分配按8字节对齐，足够存放Value和指针。
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;	// 包括这个头在内的整个块的大小。
+};
+
+void initArena(Arena* arena) {
+    arena->blocks = NULL;
+    arena->top = NULL;
+    arena->end = NULL;
+}
+
+void* arenaReallocate(Arena* arena, void* pointer, size_t oldSize, size_t newSize) {
+    if (arena == NULL) return reallocate(MEM_COMPILER, pointer, oldSize, newSize);
+    if (newSize == 0) {
+        if (pointer != NULL && (char*)pointer + ARENA_ALIGN(oldSize) == arena->top) arena->top = (char*)pointer;
+        return NULL;
+    }
+    if (newSize <= oldSize) return pointer;
+
+    // 最后一次分配的数组可以直接向后扩展。
+    if (pointer != NULL && (char*)pointer + ARENA_ALIGN(oldSize) == arena->top &&
+        (size_t)(arena->end - (char*)pointer) >= ARENA_ALIGN(newSize)) {
+        arena->top = (char*)pointer + ARENA_ALIGN(newSize);
+        return pointer;
+    }
+
+    size_t size = ARENA_ALIGN(newSize);
+    if ((size_t)(arena->end - arena->top) < size) {
+        // 每个新块至少是上一个块的两倍大，这样编译再大的脚本也只需要对数级别的块。
+        size_t blockSize = arena->blocks != NULL ? arena->blocks->size * 2 : ARENA_BLOCK_SIZE;
+        if (blockSize < sizeof(ArenaBlock) + size) blockSize = sizeof(ArenaBlock) + size;
+        ArenaBlock* block = (ArenaBlock*)reallocate(MEM_COMPILER, NULL, 0, blockSize);
+        block->next = arena->blocks;
+        block->size = blockSize;
+        arena->blocks = block;
+        arena->top = (char*)block + ARENA_ALIGN(sizeof(ArenaBlock));
+        arena->end = (char*)block + blockSize;
+    }
+
+    void* result = arena->top;
+    arena->top += size;
+    if (oldSize > 0) memcpy(result, pointer, oldSize);
+    return result;
+}
+
+void freeArena(Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        reallocate(MEM_COMPILER, block, block->size, 0);
+        block = next;
+    }
+    initArena(arena);
+}
 
 void freeObjects() {
     Obj* object = vm.objects;
@@ -3,14 +3,15 @@
 
 #include "common.h"
 #include "object.h"
+#include "table.h"
 
-// 使用这个底层宏来分配一个具有给定元素类型和数量的数组。
-#define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+// 使用这个底层宏来分配一个具有给定元素类型和数量的数组。下面所有的宏都把第一个参数（内存的用途）原样传给reallocate()。
+#define ALLOCATE(category, type, count) \
+    (type*)reallocate(category, NULL, 0, sizeof(type) * (count))
 
 // 这是围绕reallocate()的一个小包装，可以将分配的内存“调整”为零字节。
-#define FREE(type, pointer) \
-    reallocate(pointer, sizeof(type), 0)
+#define FREE(category, type, pointer) \
+    reallocate(category, pointer, sizeof(type), 0)
 
 // 这个宏会根据给定的当前容量计算出新的容量。
 // 为了获得我们想要的性能，重要的部分就是基于旧容量大小进行扩展。我们以2的系数增长，这是一个典型的取值。1.5是另外一个常见的选择。
@@ -22,16 +23,83 @@
 // 一旦我们知道了所需的容量，就可以使用GROW_ARRAY()创建或扩充数组到该大小。
 // 这个宏简化了对reallocate()函数的调用，真正的工作就是在其中完成的。
 // 宏本身负责获取数组元素类型的大小，并将生成的void*转换成正确类型的指针。
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
-    (type*)reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+#define GROW_ARRAY(category, type, pointer, oldCount, newCount) \
+    (type*)reallocate(category, pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
 
 // 与GROW_ARRAY()类似，这是对reallocate()调用的包装。这个函数通过传入0作为新的内存块大小，来释放内存。
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(category, type, pointer, oldCount) \
+    reallocate(category, pointer, sizeof(type) * (oldCount), 0)
+
+// 第一次垃圾回收在分配了这么多字节之后进行。之后每次回收结束时，下一次回收的阈值是存活字节数的GC_HEAP_GROW_FACTOR倍，但不低于这个值。
+#define GC_INITIAL_HEAP (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
 
 // 这个reallocate()函数是我们将在clox中用于所有动态内存管理的唯一函数——分配内存，释放内存以及改变现有分配的大小。
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+// 它同时也是触发垃圾回收的地方：任何增加内存的调用都可能先进行一次回收。
+// 所以在分配内存之前，调用者必须确保刚刚创建、还没有被任何根引用的对象是可达的，通常的做法是暂时把它压入虚拟机的栈中。
+// category说明这块内存的用途。同一块内存的每次调用都必须给出相同的category，这样各个分类的存活字节数才是准确的。
+void* reallocate(MemoryCategory category, void* pointer, size_t oldSize, size_t newSize);
 
+void markObject(Obj* object);
+void markValue(Value value);
+// 标记-清除回收：从根（虚拟机的栈、全局变量、正在执行的块的常量表，以及编译器正在生成的函数）出发标记所有可达的对象，然后释放其余的对象。
+void collectGarbage();
 void freeObjects();
+// 释放内存池从系统申请的所有内存页。它必须在所有通过reallocate()分配的内存都释放之后调用。
+void freeAllocator();
+// 把分配器的统计（每个大小级别的分配次数、存活块数和峰值）写到stderr，供--stats报告。
+void printAllocatorStats();
+// 把每个分类的内存统计写到stderr，供--mem-stats报告。
+void printMemoryStats();
+
+// 新生代的大小。它足够放下几千个短字符串，同时又小到可以留在CPU的二级缓存中。
+#define NURSERY_SIZE (256 * 1024)
+
+// 在新生代中分配size个字节。新生代放不下时返回NULL，调用者应当改为在老年代中分配。
+void* allocateYoung(size_t size);
+// 收回刚刚用allocateYoung()分配、还没有被任何地方引用的内存。
+void releaseYoung(void* pointer, size_t size);
+// 次要回收：把存活的年轻对象复制到老年代，然后清空新生代。它会移动对象，所以调用时C代码中的局部变量不能持有年轻对象。
+void collectNursery();
+void freeNursery();
+
+// 写屏障。把一个年轻对象存入老年代的某个位置时，必须把这个位置记录下来，次要回收会把它当作根，并在复制对象之后更新它。
+// 可能的位置有：数组中的一个元素（全局变量的值和常量表），以及哈希表中的一个条目（按键记录，因为表扩展时条目会移动）。
+// 记录只在次要回收时清空。虚拟机在记录超过REMEMBERED_SET_LIMIT条时主动进行一次次要回收，使它们占用的内存有上限。
+#define REMEMBERED_SET_LIMIT 4096
+void rememberSlot(ValueArray* array, int index);
+void rememberEntry(Table* table, ObjString* key);
+// 数组或哈希表被释放时，忘掉所有指向它的记录。
+void forgetArray(ValueArray* array);
+void forgetTable(Table* table);
+
+// ------------------竞技场------------------
+// 只在编译期间存在的数据（Compiler结构体、窥孔优化的临时数组）都从竞技场中分配。
+// 分配只是移动块内的一个指针。除了最后一次分配可以收回之外，单独释放什么也不做，编译结束时整个竞技场一次性释放。
+typedef struct ArenaBlock ArenaBlock;
+
+struct Arena {
+	ArenaBlock* blocks;	// 最近申请的块在链表的最前面。
+	char* top;
+	char* end;
+};
+
+// 竞技场的第一个块的大小。
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void initArena(Arena* arena);
+// 与reallocate()的约定相同。arena为NULL时它就是以MEM_COMPILER为分类的reallocate()，否则内存来自arena：
+// 如果pointer是最后一次分配并且块中还有空间，就原地扩展，不然就分配一块新的内存并复制旧的内容。释放（newSize为0）只收回最后一次分配，和releaseYoung()一样。
+void* arenaReallocate(Arena* arena, void* pointer, size_t oldSize, size_t newSize);
+void freeArena(Arena* arena);
+
+#define ARENA_ALLOCATE(arena, type, count) \
+    (type*)arenaReallocate(arena, NULL, 0, sizeof(type) * (count))
+
+#define ARENA_GROW_ARRAY(arena, type, pointer, oldCount, newCount) \
+    (type*)arenaReallocate(arena, pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+
+#define ARENA_FREE_ARRAY(arena, type, pointer, oldCount) \
+    arenaReallocate(arena, pointer, sizeof(type) * (oldCount), 0)
 
 #endif
\ No newline at end of file
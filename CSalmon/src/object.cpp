@@ -11,6 +11,19 @@
 #define ALLOCATE_OBJ(type, objectType) \
     (type*)allocateObject(sizeof(type), objectType)
 
+// 它在堆上分配了一个给定大小的对象。
+// 注意，这个大小不仅仅是Obj本身的大小。调用者传入字节数，以便为被创建的对象类型留出额外的载荷字段所需的空间。
+static Obj* allocateObject(size_t size, ObjType type) {
+	Obj* object = (Obj*)reallocate(type == OBJ_FUNCTION ? MEM_FUNCTION : MEM_STRING, NULL, 0, size);
+	object->type = type;
+	object->isMarked = false;
+	// 每当我们分配一个Obj时，就将其插入到列表中。
+	// 由于这是一个单链表，所以最容易插入的地方是头部。这样，我们就不需要同时存储一个指向尾部的指针并保持对其更新。
+	object->next = vm.objects;
+	vm.objects = object;
+	return object;
+}
+
 // 我们使用好朋友ALLOCATE_OBJ()来分配内存并初始化对象的头信息，以便虚拟机知道它是什么类型的对象。
 // 我们没有像对ObjString那样传入参数来初始化函数，而是将函数设置为一种空白状态——零参数、无名称、无代码。这里会在稍后创建函数后被填入数据。
 ObjFunction* newFunction() {
@@ -21,74 +34,236 @@ ObjFunction* newFunction() {
 	return function;
 }
 
-// 它在堆上分配了一个给定大小的对象。
-// 注意，这个大小不仅仅是Obj本身的大小。调用者传入字节数，以便为被创建的对象类型留出额外的载荷字段所需的空间。
-static Obj* allocateObject(size_t size, ObjType type) {
-	Obj* object = (Obj*)reallocate(NULL, 0, size);
+// 在新生代中分配一个对象。新生代放不下时退回到老年代。年轻对象不加入对象链表，它们的next字段保持为NULL。
+static Obj* allocateYoungObject(size_t size, ObjType type) {
+	Obj* object = (Obj*)allocateYoung(size);
+	if (object == NULL) return allocateObject(size, type);
 	object->type = type;
-	// 每当我们分配一个Obj时，就将其插入到列表中。
-	// 由于这是一个单链表，所以最容易插入的地方是头部。这样，我们就不需要同时存储一个指向尾部的指针并保持对其更新。
-	object->next = vm.objects;
-	vm.objects = object;
+	object->isMarked = false;
+	object->next = NULL;
 	return object;
 }
 
-// 它在堆上创建一个新的ObjString，然后初始化其字段。这有点像OOP语言中的构建函数。
-// 因此，它首先调用“基类”的构造函数来初始化Obj状态，使用了一个新的宏。
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-	ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+// 它在堆上创建一个能容纳length个字符的ObjString，字符和对象头在同一次分配中。这有点像OOP语言中的构建函数。
+// 调用者负责填入字符和哈希值。新字符串还没有被加入对象链表，也还没有被驻留：调用者可能会发现已经有一个相同的字符串，这时只需释放它。
+// 运行时连接产生的字符串大多很快就会死亡，它们在新生代中分配（young为true）；编译器创建的字符串和变量名与字节码块一样长寿，直接在老年代中分配。
+static ObjString* allocateString(int length, bool young) {
+	ObjString* string = young ? (ObjString*)allocateYoung(STRING_SIZE(length)) : NULL;
+	if (string == NULL) string = (ObjString*)reallocate(MEM_STRING, NULL, 0, STRING_SIZE(length));
+	string->obj.type = OBJ_STRING;
+	string->obj.isMarked = false;
+	string->obj.next = NULL;
 	string->length = length;
-	string->chars = chars;
-	string->hash = hash;
-	// 对于clox，我们会自动驻留每个字符串。这意味着，每当我们创建了一个新的唯一字符串，就将其添加到表中。
+	string->chars = string->storage;
+	string->storage[length] = '\0';
+	return string;
+}
+
+// 把一个填好的新字符串加入对象链表（年轻的字符串除外）。对于clox，我们会自动驻留每个字符串。这意味着，每当我们创建了一个新的唯一字符串，就将其添加到表中。
+static ObjString* registerString(ObjString* string) {
+	if (!isYoungObject(&string->obj)) {
+		string->obj.next = vm.objects;
+		vm.objects = &string->obj;
+	}
+	// 字符串表是弱引用的，所以在它被其它地方引用之前，扩展字符串表时触发的垃圾回收会释放它。我们暂时把它压入栈中，让它保持可达。
+	push(OBJ_VAL(string));
 	tableSet(&vm.strings, string, NIL_VAL);
+	pop();
 	return string;
 }
 
-// 该算法被称为“FNV-1a”，是我所知道的最短的正统哈希函数。
 // 基本思想非常简单，许多哈希函数都遵循同样的模式。从一些初始哈希值开始，通常是一个带有某些精心选择的数学特性的常量。
 // 然后遍历需要哈希的数据。对于每个字节（有些是每个字），以某种方式将比特与哈希值混合，然后将结果比特进行一些扰乱。
 // “混合”和“扰乱”的含义可以变得相当复杂。不过，最终的基本目标是均匀——我们希望得到的哈希值尽可能广泛地分散在数组范围内，以避免碰撞和聚集。
-static uint32_t hashString(const char* key, int length) {
-	uint32_t hash = 2166136261u;
-	for (int i = 0; i < length; i++) {
-		hash ^= (uint8_t)key[i];
-		hash *= 16777619;
+//
+// 我们分两步计算字符串的哈希值。第一步是多项式哈希：把字符串的每个字节看作一个多项式的系数，在HASH_MULTIPLIER处求值（对2^32取模）。
+// 多项式哈希的好处是可以拼接：a + b的多项式哈希等于a的多项式哈希乘以HASH_MULTIPLIER的b->length次幂，再加上b的多项式哈希。
+// 所以连接字符串时，我们不需要再遍历结果中的每一个字节。
+// 逐字节的FNV-1a每处理一个字节都要等上一次乘法完成；而多项式哈希一次处理8个字节时，8次乘法彼此独立，CPU可以同时执行它们。
+// 第二步是一个完整的雪崩混合（MurmurHash3的fmix32）。多项式哈希的低位只取决于每个字节的低位，而哈希表恰恰用低位来选择桶，所以在存入hash之前必须把所有的位充分打乱。
+#define HASH_MULTIPLIER 0x9E3779B1u
+
+// HASH_MULTIPLIER的n次幂（对2^32取模）。
+static constexpr uint32_t multiplierPower(uint32_t n) {
+	uint32_t result = 1;
+	uint32_t base = HASH_MULTIPLIER;
+	while (n > 0) {
+		if (n & 1) result *= base;
+		base *= base;
+		n >>= 1;
 	}
-	return hash;
+	return result;
 }
 
-// 前面的copyString()函数假定它不能拥有传入的字符的所有权。
-// 相对地，它保守地在堆上创建了一个ObjString可以拥有的字符的副本。对于传入的字符位于源字符串中间的字面量来说，这样做是正确的。
-// 但是，对于连接，我们已经在堆上动态地分配了一个字符数组。
-// 再做一个副本是多余的（而且意味着concatenate()必须记得释放它的副本）。相反，这个函数要求拥有传入字符串的所有权。
-ObjString* takeString(char* chars, int length) {
-	uint32_t hash = hashString(chars, length);
-	// 我们首先在字符串表中查找该字符串。
-	// 如果找到了，在返回它之前，我们释放传入的字符串的内存。因为所有权被传递给了这个函数，我们不再需要这个重复的字符串，所以由我们释放它。
-	ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-	if (interned != NULL) {
-		FREE_ARRAY(char, chars, length + 1);
-		return interned;
+static constexpr uint32_t POWERS[9] = {
+	multiplierPower(0), multiplierPower(1), multiplierPower(2), multiplierPower(3), multiplierPower(4),
+	multiplierPower(5), multiplierPower(6), multiplierPower(7), multiplierPower(8),
+};
+
+static uint32_t rollingHash(const char* key, int length) {
+	const uint8_t* bytes = (const uint8_t*)key;
+	uint32_t hash = 0;
+	int i = 0;
+	for (; i + 8 <= length; i += 8) {
+		hash = hash * POWERS[8]
+			+ bytes[i] * POWERS[7] + bytes[i + 1] * POWERS[6] + bytes[i + 2] * POWERS[5] + bytes[i + 3] * POWERS[4]
+			+ bytes[i + 4] * POWERS[3] + bytes[i + 5] * POWERS[2] + bytes[i + 6] * POWERS[1] + bytes[i + 7];
+	}
+	for (; i < length; i++) {
+		hash = hash * HASH_MULTIPLIER + bytes[i];
 	}
-	return allocateString(chars, length, hash);
+	return hash;
 }
 
-// 由于连接等字符串操作，一些ObjString会在运行时被动态创建。
-// 这些字符串显然需要为字符动态分配内存，这也意味着该字符串不再需要这些内存时，要释放它们。
-// 如果我们有一个ObjString存储字符串字面量，并且试图释放其中指向原始的源代码字符串的字符数组，糟糕的事情就会发生。
-// 因此，对于字面量，我们预先将字符复制到堆中。这样一来，每个ObjString都能可靠地拥有自己的字符数组，并可以释放它。
+// 多项式哈希无法区分开头多出来的'\0'字节，所以我们把长度也混合进去。
+static uint32_t finishHash(uint32_t rolling, int length) {
+	uint32_t hash = rolling ^ (uint32_t)length;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+// 对于字面量，我们把字符从源代码复制到新字符串的末尾。这样一来，每个ObjString都能可靠地拥有自己的字符，并可以与对象一起释放。
 ObjString* copyString(const char* chars, int length) {
-	uint32_t hash = hashString(chars, length);
+	uint32_t rolling = rollingHash(chars, length);
+	uint32_t hash = finishHash(rolling, length);
 	// 假定一个字符串是唯一的，这就会把它放入表中，但在此之前，我们需要实际检查字符串是否有重复。
 	// 当把一个字符串复制到新的LoxString中时，我们首先在字符串表中查找它。
 	// 如果找到了，我们就不“复制”，而是直接返回该字符串的引用。如果没有找到，我们就是落空了，则分配一个新字符串，并将其存储到字符串表中。
 	ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
 	if (interned != NULL) return interned;
-	char* heapChars = ALLOCATE(char, length + 1);
-	memcpy(heapChars, chars, length);
-	heapChars[length] = '\0';
-	return allocateString(heapChars, length, hash);
+
+	ObjString* string = allocateString(length, false);
+	memcpy(string->storage, chars, length);
+	string->hash = hash;
+	string->rollingHash = rolling;
+	return registerString(string);
+}
+
+ObjString* borrowString(const char* chars, int length) {
+	uint32_t rolling = rollingHash(chars, length);
+	uint32_t hash = finishHash(rolling, length);
+	ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+	if (interned != NULL) return interned;
+
+	// 借用字符的字符串只有对象头，没有末尾的storage。
+	ObjString* string = (ObjString*)reallocate(MEM_STRING, NULL, 0, sizeof(ObjString));
+	string->obj.type = OBJ_STRING;
+	string->obj.isMarked = false;
+	string->length = length;
+	string->chars = chars;
+	string->hash = hash;
+	string->rollingHash = rolling;
+	return registerString(string);
+}
+
+// 我们根据操作数的长度计算结果字符串的长度，分配结果字符串，然后将两个部分直接复制进去。
+// 表中可能已经有相同内容的字符串了。在这种情况下，我们释放刚刚构建的字符串，返回已有的那个。
+static ObjString* joinStrings(ObjString* a, ObjString* b, bool young) {
+	int length = a->length + b->length;
+	ObjString* string = allocateString(length, young);
+	memcpy(string->storage, a->chars, a->length);
+	memcpy(string->storage + a->length, b->chars, b->length);
+	string->rollingHash = a->rollingHash * multiplierPower((uint32_t)b->length) + b->rollingHash;
+	string->hash = finishHash(string->rollingHash, length);
+
+	ObjString* interned = tableFindString(&vm.strings, string->chars, length, string->hash);
+	if (interned != NULL) {
+		if (isYoungObject(&string->obj)) {
+			releaseYoung(string, STRING_SIZE(length));
+		}
+		else {
+			reallocate(MEM_STRING, string, STRING_SIZE(length), 0);
+		}
+		return interned;
+	}
+	return registerString(string);
+}
+
+// 编译器折叠常量时使用它，结果会成为常量，所以直接在老年代中分配。
+ObjString* concatenateStrings(ObjString* a, ObjString* b) {
+	return joinStrings(a, b, false);
+}
+
+// 连接结果达到这个长度时才使用ObjBuilder。更短的字符串复制和哈希的开销都很小，驻留它们可以让相等比较只需比较指针。
+#define MIN_BUILDER_LENGTH 128
+
+static const char* stringChars(Obj* string) {
+	if (string->type == OBJ_BUILDER) return ((ObjBuilder*)string)->buffer->chars;
+	return ((ObjString*)string)->chars;
+}
+
+static int stringLength(Obj* string) {
+	if (string->type == OBJ_BUILDER) return ((ObjBuilder*)string)->length;
+	return ((ObjString*)string)->length;
+}
+
+static uint32_t stringRollingHash(Obj* string) {
+	if (string->type == OBJ_BUILDER) return ((ObjBuilder*)string)->rollingHash;
+	return ((ObjString*)string)->rollingHash;
+}
+
+static ObjBuilder* newBuilder(StringBuffer* buffer, int length, uint32_t rolling) {
+	ObjBuilder* builder = (ObjBuilder*)allocateYoungObject(sizeof(ObjBuilder), OBJ_BUILDER);
+	builder->length = length;
+	builder->rollingHash = rolling;
+	builder->buffer = buffer;
+	buffer->refs++;
+	return builder;
+}
+
+Obj* appendString(Obj* a, Obj* b) {
+	int aLength = stringLength(a);
+	int bLength = stringLength(b);
+	int length = aLength + bLength;
+	// 任何ObjBuilder都不短于MIN_BUILDER_LENGTH，所以这里的两个操作数一定都是ObjString。
+	if (length < MIN_BUILDER_LENGTH) return (Obj*)joinStrings((ObjString*)a, (ObjString*)b, true);
+
+	StringBuffer* buffer;
+	bool fresh = a->type != OBJ_BUILDER || ((ObjBuilder*)a)->length != ((ObjBuilder*)a)->buffer->length;
+	if (fresh) {
+		// 左操作数没有看到整个缓冲区（或者它根本不是ObjBuilder），我们开一个新的缓冲区，先把左操作数复制进去。
+		buffer = ALLOCATE(MEM_STRING, StringBuffer, 1);
+		buffer->refs = 0;
+		buffer->length = 0;
+		buffer->capacity = 0;
+		buffer->chars = NULL;
+	}
+	else {
+		// 左操作数看到了整个缓冲区，我们可以直接在它后面追加。
+		buffer = ((ObjBuilder*)a)->buffer;
+	}
+
+	// 缓冲区按倍数增长，这样追加的摊销开销是常数。
+	if (buffer->capacity < length) {
+		int oldCapacity = buffer->capacity;
+		int capacity = oldCapacity < MIN_BUILDER_LENGTH ? MIN_BUILDER_LENGTH : oldCapacity;
+		while (capacity < length) capacity *= 2;
+		buffer->chars = GROW_ARRAY(MEM_STRING, char, buffer->chars, oldCapacity, capacity);
+		buffer->capacity = capacity;
+	}
+	if (fresh) memcpy(buffer->chars, stringChars(a), aLength);
+
+	// 右操作数可能与左操作数共享同一个缓冲区（比如s + s），所以要在缓冲区增长之后再读取它的字符。它看到的字节都在追加的位置之前，两段内存不会重叠。
+	memcpy(buffer->chars + aLength, stringChars(b), bLength);
+	buffer->length = length;
+
+	uint32_t rolling = stringRollingHash(a) * multiplierPower((uint32_t)bLength) + stringRollingHash(b);
+	return (Obj*)newBuilder(buffer, length, rolling);
+}
+
+bool stringsEqual(Obj* a, Obj* b) {
+	if (a->type != OBJ_STRING && a->type != OBJ_BUILDER) return false;
+	if (b->type != OBJ_STRING && b->type != OBJ_BUILDER) return false;
+
+	// 长度和哈希值是快速检查，只有它们都相同时才需要比较字节。
+	int length = stringLength(a);
+	if (stringLength(b) != length) return false;
+	if (stringRollingHash(a) != stringRollingHash(b)) return false;
+	return memcmp(stringChars(a), stringChars(b), length) == 0;
 }
 
 static void printFunction(ObjFunction* function) {
@@ -97,7 +272,7 @@ static void printFunction(ObjFunction* function) {
 		printf("<script>");
 		return;
 	}
-	printf("<fn %s>", function->name->chars);
+	printf("<fn %.*s>", function->name->length, function->name->chars);
 }
 
 void printObject(Value value) {
@@ -106,7 +281,13 @@ void printObject(Value value) {
 		printFunction(AS_FUNCTION(value));
 		break;
 	case OBJ_STRING:
-		printf("%s", AS_CSTRING(value));
+		printf("%.*s", AS_STRING(value)->length, AS_STRING(value)->chars);
 		break;
+	case OBJ_BUILDER: {
+		// 缓冲区中ObjBuilder看到的字节之后可能还有其它内容，也没有终止符，所以我们按长度输出。
+		ObjBuilder* builder = (ObjBuilder*)AS_OBJ(value);
+		fwrite(builder->buffer->chars, 1, builder->length, stdout);
+		break;
+	}
 	}
 }
\ No newline at end of file
@@ -11,17 +11,22 @@
 // 给定一个Obj*，你可以将其“向下转换”为一个/ObjString*。当然，你需要确保你的Obj*指针确实指向一个实际的ObjString中的obj字段。
 // 否则，你就会不安全地重新解释内存中的随机比特位。为了检测这种类型转换是否安全，我们再添加另一个宏。
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
+#define IS_BUILDER(value)      isObjType(value, OBJ_BUILDER)
+// 在Salmon程序看来，驻留的ObjString和还在增长的ObjBuilder都是字符串。
+#define IS_ANY_STRING(value)   (IS_STRING(value) || IS_BUILDER(value))
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
 
 typedef enum {
 	OBJ_FUNCTION,
 	OBJ_STRING,
+	OBJ_BUILDER,
 } ObjType;
 
 struct Obj {
 	ObjType type;
+	// 垃圾回收的标记位。标记阶段把从根可达的对象标记为true，清除阶段释放其余的对象，并把存活对象的标记重置为false，为下一次回收做准备。
+	bool isMarked;
 	// 今天我们至少应该做到最基本的一点：确保虚拟机可以找到每一个分配的对象，即使Lox程序本身不再引用它们，从而避免泄露内存。
 	// 我们会创建一个链表存储每个Obj。虚拟机可以遍历这个列表，找到在堆上分配的每一个对象，无论用户的程序或虚拟机的堆栈是否仍然有对它的引用。
 	// 我们可以定义一个单独的链表节点结构体，但那样我们也必须分配这些节点。相反，我们会使用侵入式列表——Obj结构体本身将作为链表节点。
@@ -37,8 +42,9 @@ typedef struct {
 	ObjString* name;
 } ObjFunction;
 
-// 字符串对象中包含一个字符数组。
-// 这些字符存储在一个单独的、由堆分配的数组中，这样我们就可以按需为每个字符串留出空间。我们还会保存数组中的字节数。
+// 字符串对象中包含一个字符数组。我们还会保存数组中的字节数。
+// 运行时创建的字符串把字符直接存放在对象的末尾（一个柔性数组成员），这样每个字符串只需要一次分配，字符与对象头紧挨在一起。
+// 字符串字面量和变量名则可以直接借用源代码中的字节，完全不需要复制，只要源代码交给了虚拟机保管（见retainSource()）。
 struct ObjString {
 	// 因为ObjString是一个Obj，它也需要所有Obj共有的状态。它通过将第一个字段置为Obj来实现这一点。
 	// C语言规定，结构体的字段在内存中是按照它们的声明顺序排列的。此外，当结构体嵌套时，内部结构体的字段会在适当的位置展开。
@@ -46,18 +52,54 @@ struct ObjString {
 	// 这是为实现一个巧妙的模式而设计的：你可以接受一个指向结构体的指针，并安全地将其转换为指向其第一个字段的指针，反之亦可。
 	Obj obj;
 	int length;
-	char* chars;
 	// 遍历整个字符串来计算哈希值是有点慢的。如果我们每次在哈希表中查找键时都要遍历字符串，就会失去哈希表的一些性能优势。
 	// 所以我们要做一件显而易见的事：缓存它。
 	// 每个ObjString 会存储其字符串的哈希码。由于字符串在Lox中是不可变的，所以我们可以预先计算一次哈希代码，并确保它永远不会失效。
 	// 提前缓存它是有道理的：分配字符串并复制其字符已然是一个O(n)的操作了，所以这是一个很好的时机来执行字符串哈希的O(n)计算。
 	uint32_t hash;
+	// 字符串内容的多项式哈希，hash就是由它混合而来的。两个字符串连接后的多项式哈希可以直接由两者的多项式哈希算出，不需要再遍历字符。
+	uint32_t rollingHash;
+	// 字符串的内容。它通常指向下面的storage；借用源代码的字符串则指向源代码，这时字符的末尾没有'\0'，所以读取时总是要使用length。
+	const char* chars;
+	// 自己拥有字符的字符串把字符存放在这里，末尾还有一个'\0'。它必须是最后一个字段。
+	char storage[];
 };
 
+// 一个长度为length、自己拥有字符的ObjString占用的字节数。借用字符的ObjString只占用sizeof(ObjString)个字节。
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+#define IS_BORROWED(string) ((string)->chars != (string)->storage)
+
+// 在循环中执行s = s + piece时，如果每次连接都把两个操作数复制到一个新的字符数组中，复制的总字节数就与最终长度的平方成正比。
+// 所以较长的连接结果不会立即变成驻留的ObjString，而是一个ObjBuilder：它引用一个可增长的共享缓冲区，看到的是缓冲区开头的length个字节。
+// 如果左操作数是一个看到了整个缓冲区的ObjBuilder，我们就直接把右操作数追加到缓冲区末尾，再创建一个看到更多字节的新ObjBuilder，
+// 这样每次连接的摊销开销只与右操作数的长度成正比。追加不会改变任何已有的ObjBuilder看到的字节，所以字符串仍然是不可变的。
+//
+// ObjBuilder不会被驻留。相等比较和打印直接读取缓冲区中的内容（见stringsEqual()和printObject()）。
+typedef struct {
+	int refs;		// 共享这个缓冲区的ObjBuilder的数量。最后一个被释放的ObjBuilder负责释放缓冲区。
+	int length;		// 已经写入的字节数。
+	int capacity;
+	char* chars;
+} StringBuffer;
+
+typedef struct {
+	Obj obj;
+	int length;
+	uint32_t rollingHash;
+	StringBuffer* buffer;
+} ObjBuilder;
+
 ObjFunction* newFunction();
 
-ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
+// 与copyString()一样驻留chars，但新字符串直接借用chars而不复制它们。chars必须在虚拟机的整个生命周期内保持有效。
+ObjString* borrowString(const char* chars, int length);
+// 连接两个字符串并驻留结果。结果的哈希值由两个操作数缓存的哈希值直接算出。结果在老年代中分配。
+ObjString* concatenateStrings(ObjString* a, ObjString* b);
+// 连接两个字符串值（ObjString或ObjBuilder）。较短的结果是驻留的ObjString，较长的结果是一个ObjBuilder。结果在新生代中分配。
+Obj* appendString(Obj* a, Obj* b);
+// 当a和b中至少有一个是ObjBuilder时，逐字节地比较两个字符串值。
+bool stringsEqual(Obj* a, Obj* b);
 void printObject(Value value);
 
 // 因为函数体使用了两次value。宏的展开方式是在主体中形参名称出现的每个地方插入实参表达式。
@@ -66,4 +108,11 @@ static inline bool isObjType(Value value, ObjType type) {
 	return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+// 驻留的字符串可以直接比较指针，只有ObjBuilder需要比较内容。
+static inline bool objectsEqual(Obj* a, Obj* b) {
+	if (a == b) return true;
+	if (a->type != OBJ_BUILDER && b->type != OBJ_BUILDER) return false;
+	return stringsEqual(a, b);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <stdlib.h>
+
+#include "memory.h"
+#include "optimizer.h"
+
+// 我们支持的超级指令。每一种都对应一个固定的原始指令序列。
+typedef enum {
+	FUSE_NONE,
+	FUSE_ADD_LOCALS,			// OP_GET_LOCAL a; OP_GET_LOCAL b; OP_ADD
+	FUSE_LESS_JUMP_IF_FALSE,	// OP_LESS; OP_JUMP_IF_FALSE offset; OP_POP
+	FUSE_ADD_CONSTANT,			// OP_CONSTANT k; OP_ADD
+} Fusion;
+
+// 检查从offset开始的指令能否与后面的指令融合。
+// 只有序列中的第一条指令可以是跳转目标。如果有跳转落在序列中间，融合后那个位置就不存在了，所以我们保留原样。
+// length输出原始序列的总字节数。
+static Fusion findFusion(Chunk* chunk, bool* isTarget, int offset, int* length) {
+	uint8_t* code = chunk->code;
+	int count = chunk->count;
+
+	switch (code[offset]) {
+	case OP_GET_LOCAL:
+		if (offset + 5 <= count &&
+			code[offset + 2] == OP_GET_LOCAL && !isTarget[offset + 2] &&
+			code[offset + 4] == OP_ADD && !isTarget[offset + 4]) {
+			*length = 5;
+			return FUSE_ADD_LOCALS;
+		}
+		break;
+	case OP_LESS:
+		if (offset + 5 <= count &&
+			code[offset + 1] == OP_JUMP_IF_FALSE && !isTarget[offset + 1] &&
+			code[offset + 4] == OP_POP && !isTarget[offset + 4]) {
+			*length = 5;
+			return FUSE_LESS_JUMP_IF_FALSE;
+		}
+		break;
+	case OP_CONSTANT:
+		if (offset + 3 <= count &&
+			code[offset + 2] == OP_ADD && !isTarget[offset + 2]) {
+			*length = 3;
+			return FUSE_ADD_CONSTANT;
+		}
+		break;
+	}
+
+	*length = instructionLength(code[offset]);
+	return FUSE_NONE;
+}
+
+static int readShort(uint8_t* code, int offset) {
+	return (code[offset] << 8) | code[offset + 1];
+}
+
+static void writeShort(uint8_t* code, int offset, int value) {
+	code[offset] = (value >> 8) & 0xff;
+	code[offset + 1] = value & 0xff;
+}
+
+void optimizeChunk(Chunk* chunk, Arena* arena) {
+	int count = chunk->count;
+	if (count == 0) return;
+
+	// 第一遍：找出所有的跳转目标。OP_JUMP和OP_JUMP_IF_FALSE向前跳，OP_LOOP向后跳，偏移量都是相对于跳转指令末尾计算的。
+	bool* isTarget = ARENA_ALLOCATE(arena, bool, count + 1);
+	for (int i = 0; i <= count; i++) isTarget[i] = false;
+	for (int offset = 0; offset < count; offset += instructionLength(chunk->code[offset])) {
+		switch (chunk->code[offset]) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+			isTarget[offset + 3 + readShort(chunk->code, offset + 1)] = true;
+			break;
+		case OP_LOOP:
+			isTarget[offset + 3 - readShort(chunk->code, offset + 1)] = true;
+			break;
+		}
+	}
+
+	// 第二遍：决定要融合哪些序列，并计算每条原始指令在改写后的新偏移量。我们只需要记录指令起始位置（以及代码末尾）的映射，
+	// 因为只有这些位置可能成为跳转目标。
+	int* newOffset = ARENA_ALLOCATE(arena, int, count + 1);
+	int write = 0;
+	for (int read = 0; read < count;) {
+		int length;
+		Fusion fusion = findFusion(chunk, isTarget, read, &length);
+		newOffset[read] = write;
+		switch (fusion) {
+		case FUSE_ADD_LOCALS:			write += 3; break;
+		case FUSE_LESS_JUMP_IF_FALSE:	write += 3; break;
+		case FUSE_ADD_CONSTANT:			write += 2; break;
+		case FUSE_NONE:					write += length; break;
+		}
+		read += length;
+	}
+	newOffset[count] = write;
+
+	// 第三遍：原地压缩代码。因为改写只会让代码变短，写入位置永远不会超过读取位置。
+	// 我们在写入之前先读出整个序列需要的所有操作数，这样即使写入覆盖了序列本身的字节也没有关系。
+	// 行号表则是重新构建的：我们把原来的行号表留在oldLines中用于查询，并在写入每条指令时向块中新的行号表添加它的行号。
+	// 超级指令使用序列中可能出错的那条指令（OP_ADD或OP_LESS）的行号，这样运行时错误报告的行号与改写前相同。
+	uint8_t* code = chunk->code;
+	Chunk oldLines = *chunk;
+	chunk->lineCount = 0;
+	chunk->lineCapacity = 0;
+	chunk->lines = NULL;
+	write = 0;
+	for (int read = 0; read < count;) {
+		int length;
+		Fusion fusion = findFusion(chunk, isTarget, read, &length);
+		switch (fusion) {
+		case FUSE_ADD_LOCALS: {
+			uint8_t a = code[read + 1];
+			uint8_t b = code[read + 3];
+			addLine(chunk, write, getLine(&oldLines, read + 4));
+			code[write] = OP_ADD_LOCALS;
+			code[write + 1] = a;
+			code[write + 2] = b;
+			write += 3;
+			break;
+		}
+		case FUSE_LESS_JUMP_IF_FALSE: {
+			// 原来的跳转目标由OP_JUMP_IF_FALSE的末尾加上偏移量得到。我们把它映射到新的位置，再相对于超级指令的末尾重新计算偏移量。
+			int target = read + 4 + readShort(code, read + 2);
+			addLine(chunk, write, getLine(&oldLines, read));
+			code[write] = OP_LESS_JUMP_IF_FALSE;
+			writeShort(code, write + 1, newOffset[target] - (write + 3));
+			write += 3;
+			break;
+		}
+		case FUSE_ADD_CONSTANT: {
+			uint8_t constant = code[read + 1];
+			addLine(chunk, write, getLine(&oldLines, read + 2));
+			code[write] = OP_ADD_CONSTANT;
+			code[write + 1] = constant;
+			write += 2;
+			break;
+		}
+		case FUSE_NONE: {
+			uint8_t instruction = code[read];
+			int jump = 0;
+			if (instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE) {
+				int target = read + 3 + readShort(code, read + 1);
+				jump = newOffset[target] - (write + 3);
+			}
+			else if (instruction == OP_LOOP) {
+				int target = read + 3 - readShort(code, read + 1);
+				jump = (write + 3) - newOffset[target];
+			}
+
+			// 一条指令的所有字节都来自同一行，所以只需要记录它第一个字节的行号。
+			addLine(chunk, write, getLine(&oldLines, read));
+			for (int i = 0; i < length; i++) {
+				code[write + i] = code[read + i];
+			}
+			if (instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || instruction == OP_LOOP) {
+				writeShort(code, write + 1, jump);
+			}
+			write += length;
+			break;
+		}
+		}
+		read += length;
+	}
+	chunk->count = write;
+
+	FREE_ARRAY(MEM_LINES, LineStart, oldLines.lines, oldLines.lineCapacity);
+	// 按分配的相反顺序释放，竞技场就可以把这些空间留给下一个函数使用。
+	ARENA_FREE_ARRAY(arena, int, newOffset, count + 1);
+	ARENA_FREE_ARRAY(arena, bool, isTarget, count + 1);
+}
\ No newline at end of file
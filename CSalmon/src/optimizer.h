@@ -0,0 +1,13 @@
+#ifndef csalmon_optimizer_h
+#define csalmon_optimizer_h
+
+#include "chunk.h"
+
+// 单遍编译器一边解析一边生成代码，它看不到后面会出现什么，所以只能生成朴素的指令序列。
+// 窥孔优化在编译完成之后对整个字节码块做一次遍历，每次只看一个很小的“窗口”，把其中常见的指令序列改写成一条等价的超级指令。
+// 虚拟机执行一条超级指令只需要一次分派，而原来的序列需要两到三次。
+// 改写会让代码变短，所以它同时负责更新每个字节对应的行号，并修补所有16位的跳转偏移量。
+// 改写过程中需要的临时数组从arena中分配。arena为NULL时它们由reallocate()分配。
+void optimizeChunk(Chunk* chunk, Arena* arena);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "profiler.h"
+
+Profiler profiler;
+
+void startProfile() {
+	if (profiler.random == 0) {
+		profiler.random = 2463534242u;
+		profiler.countdown = nextSampleInterval();
+		// 连续读两次时钟，它们之差的最小值就是每个样本中读时钟本身所占的部分。
+		profiler.overhead = UINT64_MAX;
+		for (int i = 0; i < 1000; i++) {
+			uint64_t start = readCycles();
+			uint64_t elapsed = readCycles() - start;
+			if (elapsed < profiler.overhead) profiler.overhead = elapsed;
+		}
+	}
+	profiler.previous = -1;
+	profiler.sampling = false;
+}
+
+// 一个操作码的总耗时按它的平均样本耗时乘以执行次数来估计。
+static double estimatedCycles(int instruction) {
+	if (profiler.samples[instruction] == 0) return 0;
+	return (double)profiler.cycles[instruction] / (double)profiler.samples[instruction] * (double)profiler.counts[instruction];
+}
+
+static int compareByTime(const void* a, const void* b) {
+	double x = estimatedCycles(*(const int*)a);
+	double y = estimatedCycles(*(const int*)b);
+	if (x != y) return x < y ? 1 : -1;
+	uint64_t countX = profiler.counts[*(const int*)a];
+	uint64_t countY = profiler.counts[*(const int*)b];
+	return countX < countY ? 1 : countX > countY ? -1 : 0;
+}
+
+typedef struct {
+	int first;
+	int second;
+	uint64_t count;
+} OpcodePair;
+
+static int compareByCount(const void* a, const void* b) {
+	uint64_t x = ((const OpcodePair*)a)->count;
+	uint64_t y = ((const OpcodePair*)b)->count;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// 报告中最多列出这么多对操作码。
+#define PROFILE_TOP_PAIRS 20
+
+void printProfile() {
+#ifdef PROFILE_RDTSC
+	const char* unit = "cycles";
+#else
+	const char* unit = "ns";
+#endif
+
+	int opcodes[UINT8_COUNT];
+	int opcodeCount = 0;
+	uint64_t total = 0;
+	double totalCycles = 0;
+	for (int i = 0; i < UINT8_COUNT; i++) {
+		if (profiler.counts[i] == 0) continue;
+		opcodes[opcodeCount++] = i;
+		total += profiler.counts[i];
+		totalCycles += estimatedCycles(i);
+	}
+	qsort(opcodes, opcodeCount, sizeof(int), compareByTime);
+
+	fflush(stdout);
+	fprintf(stderr, "-- profile --\n");
+	fprintf(stderr, "%-22s %12s %7s %9s %8s %7s\n", "opcode", "count", "count%", "samples", unit, "time%");
+	for (int i = 0; i < opcodeCount; i++) {
+		int op = opcodes[i];
+		double average = profiler.samples[op] == 0 ? 0 : (double)profiler.cycles[op] / (double)profiler.samples[op];
+		fprintf(stderr, "%-22s %12llu %6.2f%% %9llu %8.1f %6.2f%%\n", opcodeName((uint8_t)op),
+			(unsigned long long)profiler.counts[op], 100.0 * (double)profiler.counts[op] / (double)total,
+			(unsigned long long)profiler.samples[op], average,
+			totalCycles == 0 ? 0.0 : 100.0 * estimatedCycles(op) / totalCycles);
+	}
+
+	// 相邻的一对操作码只可能由已经出现过的操作码组成，所以只需要检查它们之间的组合。
+	OpcodePair* pairs = (OpcodePair*)malloc(sizeof(OpcodePair) * opcodeCount * opcodeCount);
+	int pairCount = 0;
+	uint64_t pairTotal = 0;
+	for (int i = 0; i < opcodeCount; i++) {
+		for (int j = 0; j < opcodeCount; j++) {
+			uint64_t count = profiler.pairs[opcodes[i]][opcodes[j]];
+			if (count == 0) continue;
+			pairs[pairCount++] = { opcodes[i], opcodes[j], count };
+			pairTotal += count;
+		}
+	}
+	qsort(pairs, pairCount, sizeof(OpcodePair), compareByCount);
+
+	fprintf(stderr, "%-45s %12s %7s\n", "pair", "count", "pairs%");
+	for (int i = 0; i < pairCount && i < PROFILE_TOP_PAIRS; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "%s -> %s", opcodeName((uint8_t)pairs[i].first), opcodeName((uint8_t)pairs[i].second));
+		fprintf(stderr, "%-45s %12llu %6.2f%%\n", name, (unsigned long long)pairs[i].count,
+			100.0 * (double)pairs[i].count / (double)pairTotal);
+	}
+	free(pairs);
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef csalmon_profiler_h
+#define csalmon_profiler_h
+
+#include <chrono>
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PROFILE_RDTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// --profile打开的分析器统计三样东西：每个操作码执行的次数，每对相邻操作码出现的次数（它告诉我们哪些序列值得融合成超级指令），
+// 以及每个操作码平均花费的时间。
+// 计时是抽样的：每隔一段随机的间隔（平均PROFILE_SAMPLE_INTERVAL条指令），我们在分派一条指令之前读一次时钟，在分派下一条指令之前再读一次，
+// 两者之差就是这条指令的耗时，包括它的分派跳转以及它可能触发的垃圾回收。间隔是随机的，这样循环体的长度恰好是间隔的倍数时，也不会总是抽到同一条指令。
+// 在x86上时钟是时间戳计数器（rdtsc），单位是参考周期；其它平台上使用steady_clock，单位是纳秒。读时钟本身的开销在启动时测出，并从每个样本中减去。
+#define PROFILE_SAMPLE_INTERVAL 64
+
+typedef struct {
+	uint64_t counts[UINT8_COUNT];
+	uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+	uint64_t cycles[UINT8_COUNT];
+	uint64_t samples[UINT8_COUNT];
+	int previous;			// 上一条指令的操作码。-1表示这是run()执行的第一条指令。
+	bool sampling;			// 上一条指令正在被计时，sampleStart是它开始时的时钟读数。
+	uint64_t sampleStart;
+	uint32_t countdown;		// 距离下一次抽样还有多少条指令。
+	uint32_t random;
+	uint64_t overhead;		// 连续两次读时钟之间的最小差值。
+} Profiler;
+
+extern Profiler profiler;
+
+static inline uint64_t readCycles() {
+#ifdef PROFILE_RDTSC
+	return __rdtsc();
+#else
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// 抽样间隔在1到2*PROFILE_SAMPLE_INTERVAL-1之间均匀分布。xorshift足够随机，而且不需要任何库函数。
+static inline uint32_t nextSampleInterval() {
+	uint32_t x = profiler.random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	profiler.random = x;
+	return x % (2 * PROFILE_SAMPLE_INTERVAL - 1) + 1;
+}
+
+// 解释器循环的分析实例在分派每条指令之前调用它。
+static inline void profileInstruction(uint8_t instruction) {
+	if (profiler.sampling) {
+		uint64_t elapsed = readCycles() - profiler.sampleStart;
+		profiler.cycles[profiler.previous] += elapsed > profiler.overhead ? elapsed - profiler.overhead : 0;
+		profiler.samples[profiler.previous]++;
+		profiler.sampling = false;
+	}
+	profiler.counts[instruction]++;
+	if (profiler.previous >= 0) profiler.pairs[profiler.previous][instruction]++;
+	profiler.previous = instruction;
+	if (--profiler.countdown == 0) {
+		profiler.countdown = nextSampleInterval();
+		profiler.sampling = true;
+		// 尽可能晚地读时钟，让样本中包含的分析器自己的代码最少。
+		profiler.sampleStart = readCycles();
+	}
+}
+
+// 每次开始执行一个字节码块之前调用。上一个块的最后一条指令不会与这个块的第一条指令组成一对，也不会被计时。
+void startProfile();
+// 把报告写到stderr：按估计的总耗时排序的操作码，然后是出现最多的操作码对。
+void printProfile();
+
+#endif
\ No newline at end of file
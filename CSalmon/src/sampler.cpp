@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#include "sampler.h"
+#include "vm.h"
+
+typedef struct {
+	// 信号处理程序使用的状态。code和count描述正在执行的块，hits[offset]是落在这个偏移量的指令上的样本数。
+	const uint8_t* code;
+	int count;
+	volatile uint32_t* hits;
+	// 落在块之外的样本（例如虚拟机正在执行块之前的准备工作）。
+	volatile uint32_t missed;
+	// 已经归结好的样本：lineHits[line]是落在第line行上的样本数。
+	uint64_t* lineHits;
+	int lineCapacity;
+} Sampler;
+
+static Sampler sampler;
+
+#ifndef _WIN32
+// 这个函数在信号处理程序中运行，所以只能读写已经存在的内存。
+static void handleSample(int signal) {
+	(void)signal;
+	const uint8_t* ip = vm.sampledIp;
+	if (ip != NULL && sampler.hits != NULL && ip >= sampler.code && ip < sampler.code + sampler.count) {
+		sampler.hits[ip - sampler.code] = sampler.hits[ip - sampler.code] + 1;
+	}
+	else {
+		sampler.missed = sampler.missed + 1;
+	}
+}
+
+static void setTimer(long micros) {
+	struct itimerval timer;
+	timer.it_interval.tv_sec = micros / 1000000;
+	timer.it_interval.tv_usec = micros % 1000000;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+bool initSampler() {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handleSample;
+	sigemptyset(&action.sa_mask);
+	// 被信号打断的系统调用（例如读写文件）会自动重新开始，脚本不会看到EINTR。
+	action.sa_flags = SA_RESTART;
+	if (sigaction(SIGPROF, &action, NULL) != 0) {
+		fprintf(stderr, "Could not install the sampling profiler.\n");
+		return false;
+	}
+	return true;
+}
+
+void beginSampling(Chunk* chunk) {
+	sampler.hits = (volatile uint32_t*)calloc(chunk->count > 0 ? chunk->count : 1, sizeof(uint32_t));
+	if (sampler.hits == NULL) exit(1);
+	sampler.code = chunk->code;
+	sampler.count = chunk->count;
+	setTimer(SAMPLE_INTERVAL_MICROS);
+}
+
+void endSampling(Chunk* chunk) {
+	// 停止计时器之后，还可能有一个已经产生、尚未递送的信号。我们在归结样本期间屏蔽它，然后再让信号处理程序看不到这个块。
+	setTimer(0);
+	sigset_t block;
+	sigset_t previous;
+	sigemptyset(&block);
+	sigaddset(&block, SIGPROF);
+	sigprocmask(SIG_BLOCK, &block, &previous);
+
+	for (int offset = 0; offset < sampler.count; offset++) {
+		if (sampler.hits[offset] == 0) continue;
+		int line = getLine(chunk, offset);
+		if (line >= sampler.lineCapacity) {
+			int capacity = sampler.lineCapacity < 64 ? 64 : sampler.lineCapacity;
+			while (capacity <= line) capacity *= 2;
+			sampler.lineHits = (uint64_t*)realloc(sampler.lineHits, sizeof(uint64_t) * capacity);
+			if (sampler.lineHits == NULL) exit(1);
+			memset(sampler.lineHits + sampler.lineCapacity, 0, sizeof(uint64_t) * (capacity - sampler.lineCapacity));
+			sampler.lineCapacity = capacity;
+		}
+		sampler.lineHits[line] += sampler.hits[offset];
+	}
+
+	free((void*)sampler.hits);
+	sampler.hits = NULL;
+	sampler.code = NULL;
+	sampler.count = 0;
+	sigprocmask(SIG_SETMASK, &previous, NULL);
+}
+#else
+// Windows没有SIGPROF和setitimer()。
+bool initSampler() {
+	fprintf(stderr, "The sampling profiler is not supported on this platform.\n");
+	return false;
+}
+
+void beginSampling(Chunk* chunk) {
+	(void)chunk;
+}
+
+void endSampling(Chunk* chunk) {
+	(void)chunk;
+}
+#endif
+
+bool writeSamples(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open file \"%s\".\n", path);
+		return false;
+	}
+	for (int line = 0; line < sampler.lineCapacity; line++) {
+		if (sampler.lineHits[line] == 0) continue;
+		fprintf(file, "<script>;line %d %llu\n", line, (unsigned long long)sampler.lineHits[line]);
+	}
+	if (sampler.missed > 0) fprintf(file, "<vm> %u\n", (unsigned)sampler.missed);
+	bool written = fclose(file) == 0;
+	if (!written) fprintf(stderr, "Could not write file \"%s\".\n", path);
+	return written;
+}
+
+void freeSampler() {
+	free(sampler.lineHits);
+	sampler.lineHits = NULL;
+	sampler.lineCapacity = 0;
+}
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef csalmon_sampler_h
+#define csalmon_sampler_h
+
+#include "chunk.h"
+
+// 抽样分析器定期打断正在执行的脚本，记录它当时执行到了哪条指令，最后把这些样本归结到源代码的行上。
+// 与--profile不同，它不关心操作码，而是回答“脚本的哪几行最耗时”，所以不需要手工给脚本加计时代码就能找到热点。
+//
+// 计时器是setitimer(ITIMER_PROF)，它按进程消耗的CPU时间触发SIGPROF。信号处理程序是异步信号安全的：它只读取虚拟机公开的指令指针，
+// 然后给一个预先分配好的、按字节码偏移量索引的计数数组加一，不分配内存，也不调用任何库函数。
+// 只有解释器循环的抽样实例会在分派每条指令之前公开它的指令指针，不抽样时运行的仍然是原来的循环，计时器也不会启动，所以没有任何开销。
+//
+// 每次执行完一个字节码块，在块被释放之前，我们通过行号表把各个偏移量的计数累加到行上。退出时按火焰图工具使用的折叠栈格式写出结果：
+// 每行是以分号分隔的帧，再加一个空格和样本数，例如“<script>;line 42 17”。现在只有顶层脚本一个函数，有了函数调用之后，外层的帧就是调用栈上的函数名。
+
+// 抽样的间隔（微秒，按CPU时间计算）。内核按时钟节拍统计CPU时间，所以实际的间隔不会短于一个节拍（通常是1到4毫秒）。
+#define SAMPLE_INTERVAL_MICROS 1000
+
+// 安装信号处理程序。当前平台不支持时报告错误并返回false。
+bool initSampler();
+// 在执行chunk之前调用：为它分配计数数组并启动计时器。
+void beginSampling(Chunk* chunk);
+// 在chunk执行完、还没有被释放时调用：停止计时器，把计数归结到源代码的行上。
+void endSampling(Chunk* chunk);
+// 以折叠栈格式把所有样本写入path。失败时报告错误并返回false。
+bool writeSamples(const char* path);
+void freeSampler();
+
+#endif
\ No newline at end of file
@@ -1,15 +1,24 @@
 #include <stdio.h>
 #include <string.h>
+#include <bit>
 
 #include "common.h"
 #include "scanner.h"
 
+#if defined(SCANNER_AVX2)
+#include <immintrin.h>
+#elif defined(SCANNER_SSE2)
+#include <emmintrin.h>
+#endif
+
 // 当我们的扫描器一点点处理用户的源代码时，它会跟踪自己已经走了多远。
 // 就像我们在虚拟机中所做的那样，我们将状态封装在一个结构体中，然后创建一个该类型的顶层模块变量，这样就不必在所有的函数之间传递它。
 // 我们甚至没有保留指向源代码字符串起点的指针。扫描器只处理一遍代码，然后就结束了。
 typedef struct {
 	const char* start;
 	const char* current;
+	// 源代码末尾的'\0'。批量扫描只在离它至少还有一整块的地方才一次读取一块，这样永远不会读到源代码之外的内存。
+	const char* end;
 	int line;
 } Scanner;
 
@@ -19,9 +28,175 @@ void initScanner(const char* source) {
 	// 我们从第一行的第一个字符开始，就像一个运动员蹲在起跑线上。
 	scanner.start = source;
 	scanner.current = source;
+	scanner.end = source + strlen(source);
 	scanner.line = 1;
 }
 
+// 下面这些函数从p开始批量地跳过一类字符，返回第一个不属于这一类的字符的位置（最远到源代码末尾的'\0'）。
+// 有SIMD可用时，我们一次把一整块字节载入向量寄存器，与要找的字符逐字节比较，再把比较结果压缩成一个位掩码：第i位为1表示第i个字节匹配。
+// 掩码中最低的1位就是第一个匹配的位置，对掩码计数就能知道块中有几个换行符。离末尾不足一整块时，剩下的字节逐个处理。
+#if defined(SCANNER_AVX2)
+typedef __m256i Block;
+#define BLOCK_SIZE 32
+
+static inline Block loadBlock(const char* p) {
+	return _mm256_loadu_si256((const __m256i*)p);
+}
+
+static inline uint32_t equalMask(Block block, char c) {
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+}
+
+// 字节值在[low, low + count)中的位。SIMD只有有符号比较，所以我们先把区间平移到-128开始，这样区间外的字节都会比-128 + count大。
+static inline uint32_t rangeMask(Block block, char low, int count) {
+	Block shifted = _mm256_add_epi8(block, _mm256_set1_epi8((char)(-128 - low)));
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + count)), shifted));
+}
+
+// 把大写字母变成小写字母。其它字符也会被改变，但不会因此落进'a'到'z'的区间。
+static inline Block foldCase(Block block) {
+	return _mm256_or_si256(block, _mm256_set1_epi8(0x20));
+}
+#elif defined(SCANNER_SSE2)
+typedef __m128i Block;
+#define BLOCK_SIZE 16
+
+static inline Block loadBlock(const char* p) {
+	return _mm_loadu_si128((const __m128i*)p);
+}
+
+static inline uint32_t equalMask(Block block, char c) {
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+}
+
+static inline uint32_t rangeMask(Block block, char low, int count) {
+	Block shifted = _mm_add_epi8(block, _mm_set1_epi8((char)(-128 - low)));
+	return (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + count))));
+}
+
+static inline Block foldCase(Block block) {
+	return _mm_or_si128(block, _mm_set1_epi8(0x20));
+}
+#endif
+
+#ifdef BLOCK_SIZE
+// 大多数空白和标识符都很短（一个空格、一个两三个字母的变量名），为它们载入一整块反而更慢。
+// 所以空白、标识符和数字的前SHORT_RUN个字节仍然逐个检查，只有更长的连续字符才交给SIMD。字符串和注释通常都很长，直接按块扫描。
+#define SHORT_RUN 8
+
+// 掩码中低于第count位的部分。
+static inline uint32_t lowBits(int count) {
+	return count >= 32 ? 0xFFFFFFFFu : (1u << count) - 1;
+}
+
+// 块中所有不是标识符字符（字母、数字和下划线）的字节。
+static inline uint32_t nonIdentifierMask(Block block) {
+	uint32_t identifier = rangeMask(foldCase(block), 'a', 26) | rangeMask(block, '0', 10) | equalMask(block, '_');
+	return ~identifier & lowBits(BLOCK_SIZE);
+}
+#endif
+
+static bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static bool isAlpha(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// 跳过空格、制表符、回车和换行，同时累计跳过的换行数。
+static const char* skipBlanks(const char* p, int* line) {
+#ifdef BLOCK_SIZE
+	for (const char* limit = p + SHORT_RUN; p < limit; p++) {
+		if (*p == '\n') (*line)++;
+		else if (*p != ' ' && *p != '\t' && *p != '\r') return p;
+	}
+	while (p + BLOCK_SIZE <= scanner.end) {
+		Block block = loadBlock(p);
+		uint32_t newlines = equalMask(block, '\n');
+		uint32_t blanks = equalMask(block, ' ') | equalMask(block, '\t') | equalMask(block, '\r') | newlines;
+		uint32_t stop = ~blanks & lowBits(BLOCK_SIZE);
+		if (stop != 0) {
+			int index = std::countr_zero(stop);
+			*line += std::popcount(newlines & lowBits(index));
+			return p + index;
+		}
+		*line += std::popcount(newlines);
+		p += BLOCK_SIZE;
+	}
+#endif
+	for (;; p++) {
+		if (*p == '\n') (*line)++;
+		else if (*p != ' ' && *p != '\t' && *p != '\r') return p;
+	}
+}
+
+// 找到行尾的换行符（但不跳过它）。注释的内容就是这样被跳过的。
+static const char* skipToLineEnd(const char* p) {
+#ifdef BLOCK_SIZE
+	while (p + BLOCK_SIZE <= scanner.end) {
+		uint32_t newlines = equalMask(loadBlock(p), '\n');
+		if (newlines != 0) return p + std::countr_zero(newlines);
+		p += BLOCK_SIZE;
+	}
+#endif
+	while (*p != '\n' && *p != '\0') p++;
+	return p;
+}
+
+// 找到字符串字面量的右引号，同时累计字符串中的换行数。
+static const char* skipStringBody(const char* p, int* line) {
+#ifdef BLOCK_SIZE
+	while (p + BLOCK_SIZE <= scanner.end) {
+		Block block = loadBlock(p);
+		uint32_t quotes = equalMask(block, '"');
+		uint32_t newlines = equalMask(block, '\n');
+		if (quotes != 0) {
+			int index = std::countr_zero(quotes);
+			*line += std::popcount(newlines & lowBits(index));
+			return p + index;
+		}
+		*line += std::popcount(newlines);
+		p += BLOCK_SIZE;
+	}
+#endif
+	for (; *p != '"' && *p != '\0'; p++) {
+		if (*p == '\n') (*line)++;
+	}
+	return p;
+}
+
+// 跳过标识符中第一个字母之后的字母、数字和下划线。
+static const char* skipIdentifierChars(const char* p) {
+#ifdef BLOCK_SIZE
+	for (const char* limit = p + SHORT_RUN; p < limit; p++) {
+		if (!isAlpha(*p) && !isDigit(*p)) return p;
+	}
+	while (p + BLOCK_SIZE <= scanner.end) {
+		uint32_t stop = nonIdentifierMask(loadBlock(p));
+		if (stop != 0) return p + std::countr_zero(stop);
+		p += BLOCK_SIZE;
+	}
+#endif
+	while (isAlpha(*p) || isDigit(*p)) p++;
+	return p;
+}
+
+static const char* skipDigits(const char* p) {
+#ifdef BLOCK_SIZE
+	for (const char* limit = p + SHORT_RUN; p < limit; p++) {
+		if (!isDigit(*p)) return p;
+	}
+	while (p + BLOCK_SIZE <= scanner.end) {
+		uint32_t stop = ~rangeMask(loadBlock(p), '0', 10) & lowBits(BLOCK_SIZE);
+		if (stop != 0) return p + std::countr_zero(stop);
+		p += BLOCK_SIZE;
+	}
+#endif
+	while (isDigit(*p)) p++;
+	return p;
+}
+
 // 这个函数依赖于几个辅助函数，其中大部分都是在jlox中已熟悉的。
 static bool isAtEnd() {
 	return *scanner.current == '\0';
@@ -82,19 +257,16 @@ static void skipWhitespace() {
 		case ' ':
 		case '\r':
 		case '\t':
-			advance();
-			break;
 		case '\n':
-			// 当我们消费换行符时，也会增加当前行数。
-			scanner.line++;
-			advance();
+			// 空白字符往往成片出现（比如缩进），所以我们一次跳过一整段。当我们消费换行符时，也会增加当前行数。
+			scanner.current = skipBlanks(scanner.current, &scanner.line);
 			break;
 		case '/':
 			// Lox中的注释以//开头，因此与!=类似，我们需要前瞻第二个字符。
 			if (peekNext() == '/') {
-				// 我们使用peek()来检查换行符，但是不消费它。
+				// 我们只跳到换行符为止，但是不消费它。
 				// 这样一来，换行符将成为skipWhitespace()外部下一轮循环中的当前字符，我们就能识别它并增加scanner.line。
-				while (peek() != '\n' && !isAtEnd()) advance();
+				scanner.current = skipToLineEnd(scanner.current);
 			}
 			else {
 				return;
@@ -109,10 +281,7 @@ static void skipWhitespace() {
 // 在clox中，词法标识只存储词素——即用户源代码中出现的字符序列。稍后在编译器中，当我们准备将其存储在字节码块中的常量表中时，我们会将词素转换为运行时值。
 static Token string() {
 	// 我们消费字符，直到遇见右引号。我们也会追踪字符串字面量中的换行符（Lox支持多行字符串）。
-	while (peek() != '"' && !isAtEnd()) {
-		if (peek() == '\n') scanner.line++;
-		advance();
-	}
+	scanner.current = skipStringBody(scanner.current, &scanner.line);
 
 	// 并且，与之前一样，我们会优雅地处理在找到结束引号之前源代码耗尽的问题。
 	if (isAtEnd()) return errorToken("Unterminated string.");
@@ -121,29 +290,21 @@ static Token string() {
 	return makeToken(TOKEN_STRING);
 }
 
-static bool isDigit(char c) {
-	return c >= '0' && c <= '9';
-}
-
 // 它与jlox版本几乎是相同的，只是我们还没有将词素转换为浮点数。
 static Token number() {
-	while (isDigit(peek())) advance();
+	scanner.current = skipDigits(scanner.current);
 
 	// 寻找小数部分。
 	if (peek() == '.' && isDigit(peekNext())) {
 		// 消费 "."。
 		advance();
 
-		while (isDigit(peek())) advance();
+		scanner.current = skipDigits(scanner.current);
 	}
 
 	return makeToken(TOKEN_NUMBER);
 }
 
-static bool isAlpha(char c) {
-	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-}
-
 // 我们将此用于树中的所有无分支路径。一旦我们发现一个前缀，其只有可能是一种保留字，我们需要验证两件事。词素必须与关键字一样长。
 // 如果我们字符数量确实正确，并且它们是我们想要的字符，那这就是一个关键字，我们返回相关的标识类型。否则，它必然是一个普通的标识符。
 static TokenType checkKeyword(int start, int length,
@@ -204,7 +365,7 @@ static TokenType identifierType() {
 // 一旦我们发现一个标识符，我们就通过下面的方法扫描其余部分。
 // 在第一个字母之后，我们也允许使用数字，并且我们会一直消费字母数字，直到消费完为止。然后我们生成一个具有适当类型的词法标识。
 static Token identifier() {
-	while (isAlpha(peek()) || isDigit(peek())) advance();
+	scanner.current = skipIdentifierChars(scanner.current);
 	return makeToken(identifierType());
 }
 
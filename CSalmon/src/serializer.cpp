@@ -0,0 +1,427 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "memory.h"
+#include "object.h"
+#include "serializer.h"
+#include "vm.h"
+
+// .salc文件的布局如下。所有整数都按本机字节序存储，每一节的起始位置都按4字节对齐，这样行号表和常量偏移表可以直接在映射的内存中使用。
+//
+//   文件头          SalcHeader，32字节
+//   行号表          lineCount个LineStart，与Chunk中的游程编码行号表完全相同
+//   字节码          codeLength个字节，之后补齐到4字节边界
+//   常量偏移表      constantCount个uint32_t，第i项是第i个常量的记录在文件中的偏移量
+//   常量记录        每条记录以一个类型字节开头：数字之后是8字节的double，字符串之后是uint32_t长度和字符
+//   全局变量名      globalCount条记录，每条是uint32_t长度和字符，按槽号排列
+//
+// 校验和是对文件头之后所有字节计算的FNV-1a哈希。文件头中的版本号是serializer.h中的SALC_VERSION。
+
+typedef struct {
+	char magic[4];			// "SALC"
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t checksum;
+	uint32_t size;			// 整个文件的字节数，用来发现被截断的文件。
+	uint32_t codeLength;
+	uint32_t lineCount;
+	uint32_t constantCount;
+	uint32_t globalCount;
+} SalcHeader;
+
+typedef enum {
+	CONSTANT_NUMBER,
+	CONSTANT_STRING,
+} ConstantTag;
+
+static uint32_t checksum(const uint8_t* bytes, size_t length) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static size_t alignUp(size_t offset) {
+	return (offset + 3) & ~(size_t)3;
+}
+
+// ------------------写入------------------
+// 我们先在内存中构建整个文件，最后一次性写出。
+typedef struct {
+	int count;
+	int capacity;
+	uint8_t* bytes;
+} Buffer;
+
+static void writeBytes(Buffer* buffer, const void* bytes, int length) {
+	if (buffer->capacity < buffer->count + length) {
+		int oldCapacity = buffer->capacity;
+		int capacity = oldCapacity;
+		while (capacity < buffer->count + length) capacity = GROW_CAPACITY(capacity);
+		buffer->bytes = GROW_ARRAY(MEM_OTHER, uint8_t, buffer->bytes, oldCapacity, capacity);
+		buffer->capacity = capacity;
+	}
+	memcpy(buffer->bytes + buffer->count, bytes, length);
+	buffer->count += length;
+}
+
+static void writeUint32(Buffer* buffer, uint32_t value) {
+	writeBytes(buffer, &value, sizeof(uint32_t));
+}
+
+static void writeString(Buffer* buffer, ObjString* string) {
+	writeUint32(buffer, (uint32_t)string->length);
+	writeBytes(buffer, string->chars, string->length);
+}
+
+static void pad(Buffer* buffer) {
+	static const uint8_t zeros[4] = { 0, 0, 0, 0 };
+	writeBytes(buffer, zeros, (int)(alignUp(buffer->count) - buffer->count));
+}
+
+bool writeBytecodeFile(Chunk* chunk, const char* path) {
+	Buffer buffer = { 0, 0, NULL };
+	SalcHeader header;
+	memset(&header, 0, sizeof(SalcHeader));
+	// 先为文件头占位，等所有的节都写完后再填入。
+	writeBytes(&buffer, &header, sizeof(SalcHeader));
+
+	writeBytes(&buffer, chunk->lines, chunk->lineCount * (int)sizeof(LineStart));
+	writeBytes(&buffer, chunk->code, chunk->count);
+	pad(&buffer);
+
+	// 常量偏移表同样先占位，在写出每条常量记录时回填。
+	int offsetTable = buffer.count;
+	for (int i = 0; i < chunk->constants.count; i++) writeUint32(&buffer, 0);
+	for (int i = 0; i < chunk->constants.count; i++) {
+		uint32_t offset = (uint32_t)buffer.count;
+		memcpy(buffer.bytes + offsetTable + i * sizeof(uint32_t), &offset, sizeof(uint32_t));
+
+		Value value = chunk->constants.values[i];
+		if (IS_NUMBER(value)) {
+			uint8_t tag = CONSTANT_NUMBER;
+			double number = AS_NUMBER(value);
+			writeBytes(&buffer, &tag, 1);
+			writeBytes(&buffer, &number, sizeof(double));
+		}
+		else if (IS_STRING(value)) {
+			uint8_t tag = CONSTANT_STRING;
+			writeBytes(&buffer, &tag, 1);
+			writeString(&buffer, AS_STRING(value));
+		}
+		else {
+			// 编译器只会把数字和字符串放进常量表。
+			fprintf(stderr, "Cannot serialize constant %d.\n", i);
+			FREE_ARRAY(MEM_OTHER, uint8_t, buffer.bytes, buffer.capacity);
+			return false;
+		}
+	}
+
+	// 字节码中的全局变量操作数是槽号，所以我们按槽号的顺序写出变量名，载入时以同样的顺序注册它们。
+	for (int i = 0; i < vm.globalNames.count; i++) {
+		writeString(&buffer, AS_STRING(vm.globalNames.values[i]));
+	}
+
+	memcpy(header.magic, "SALC", 4);
+	header.version = SALC_VERSION;
+	header.size = (uint32_t)buffer.count;
+	header.codeLength = (uint32_t)chunk->count;
+	header.lineCount = (uint32_t)chunk->lineCount;
+	header.constantCount = (uint32_t)chunk->constants.count;
+	header.globalCount = (uint32_t)vm.globalNames.count;
+	header.checksum = checksum(buffer.bytes + sizeof(SalcHeader), buffer.count - sizeof(SalcHeader));
+	memcpy(buffer.bytes, &header, sizeof(SalcHeader));
+
+	FILE* file = fopen(path, "wb");
+	bool success = file != NULL &&
+		fwrite(buffer.bytes, 1, buffer.count, file) == (size_t)buffer.count;
+	if (file != NULL && fclose(file) != 0) success = false;
+	if (!success) {
+		fprintf(stderr, "Could not write file \"%s\".\n", path);
+	}
+
+	FREE_ARRAY(MEM_OTHER, uint8_t, buffer.bytes, buffer.capacity);
+	return success;
+}
+
+// ------------------载入------------------
+static const uint8_t* mapFile(const char* path, size_t* size) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return NULL;
+	}
+	// 映射视图会让文件保持打开，所以创建视图之后就可以关闭这两个句柄了。
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) return NULL;
+	const uint8_t* data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	*size = (size_t)fileSize.QuadPart;
+	return data;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	// 映射会让文件保持打开，所以映射之后就可以关闭文件描述符了。
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+	*size = (size_t)st.st_size;
+	return (const uint8_t*)data;
+#endif
+}
+
+static void unmapFile(const uint8_t* data, size_t size) {
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, size);
+#endif
+}
+
+// 检查一条长度前缀的字符串记录是否完整地位于文件之内。成功时返回记录之后的偏移量，否则返回0。
+static size_t checkString(const uint8_t* data, size_t size, size_t offset) {
+	if (offset > size || size - offset < sizeof(uint32_t)) return 0;
+	uint32_t length;
+	memcpy(&length, data + offset, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	if (size - offset < length) return 0;
+	return offset + length;
+}
+
+static uint16_t readShort(const uint8_t* code) {
+	return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+// 检查字节码本身。虚拟机执行指令时不做任何检查，所以载入时我们要逐条遍历一次，确认：
+// 每个操作码都是已知的，操作数完整地位于字节码之内；常量下标小于常量的数量，全局变量槽号小于全局变量的数量；
+// 每个跳转目标都落在字节码之内某条指令的起始位置上；最后一条指令是OP_RETURN，这样执行永远不会越过字节码的末尾。
+static bool validateCode(const uint8_t* code, uint32_t length, const SalcHeader* header) {
+	// 第一遍记录每条指令的起始位置并检查操作数，第二遍再检查跳转目标，因为向前跳转的目标在第一遍时还没有遇到。
+	bool* starts = ALLOCATE(MEM_OTHER, bool, length);
+	memset(starts, 0, length);
+	bool valid = true;
+	uint32_t last = 0;
+	uint32_t offset = 0;
+	while (valid && offset < length) {
+		uint32_t size = (uint32_t)instructionLength(code[offset]);
+		if (size == 0 || length - offset < size) {
+			valid = false;
+			break;
+		}
+		starts[offset] = true;
+		last = offset;
+		switch (code[offset]) {
+		case OP_CONSTANT:
+		case OP_ADD_CONSTANT:
+			valid = code[offset + 1] < header->constantCount;
+			break;
+		case OP_GET_GLOBAL:
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_GLOBAL:
+			valid = readShort(code + offset + 1) < header->globalCount;
+			break;
+		}
+		offset += size;
+	}
+	if (valid) valid = code[last] == OP_RETURN;
+
+	for (offset = 0; valid && offset < length; offset += (uint32_t)instructionLength(code[offset])) {
+		int64_t target;
+		switch (code[offset]) {
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+		case OP_LESS_JUMP_IF_FALSE:
+			target = (int64_t)offset + 3 + readShort(code + offset + 1);
+			break;
+		case OP_LOOP:
+			target = (int64_t)offset + 3 - readShort(code + offset + 1);
+			break;
+		default:
+			continue;
+		}
+		valid = target >= 0 && target < length && starts[target];
+	}
+
+	FREE_ARRAY(MEM_OTHER, bool, starts, length);
+	return valid;
+}
+
+// 全局变量名必须互不相同。重复的名称会让declareGlobal()返回之前的槽号，之后所有名称的槽号都会错位。
+// 我们按（哈希值，长度，字符）排序所有的名称，这样相同的名称一定相邻。
+typedef struct {
+	uint32_t hash;
+	uint32_t length;
+	const uint8_t* chars;
+} NameRecord;
+
+static bool uniqueNames(const uint8_t* data, size_t offset, uint32_t count) {
+	if (count < 2) return true;
+	NameRecord* names = ALLOCATE(MEM_OTHER, NameRecord, count);
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(&names[i].length, data + offset, sizeof(uint32_t));
+		names[i].chars = data + offset + sizeof(uint32_t);
+		names[i].hash = checksum(names[i].chars, names[i].length);
+		offset += sizeof(uint32_t) + names[i].length;
+	}
+	std::sort(names, names + count, [](const NameRecord& a, const NameRecord& b) {
+		if (a.hash != b.hash) return a.hash < b.hash;
+		if (a.length != b.length) return a.length < b.length;
+		return memcmp(a.chars, b.chars, a.length) < 0;
+	});
+	bool unique = true;
+	for (uint32_t i = 1; unique && i < count; i++) {
+		const NameRecord* a = &names[i - 1];
+		const NameRecord* b = &names[i];
+		unique = a->hash != b->hash || a->length != b->length || memcmp(a->chars, b->chars, a->length) != 0;
+	}
+	FREE_ARRAY(MEM_OTHER, NameRecord, names, count);
+	return unique;
+}
+
+// 在使用文件中的任何内容之前，我们先检查文件头、校验和、每一节的边界、字节码中的每条指令以及全局变量名。
+// 校验和只能发现意外的损坏，人为构造的文件可以带有正确的校验和。其余的检查保证了无论文件内容是什么，载入时不会越界读取文件，执行时也不会越界访问常量表、全局变量数组或者字节码。
+// 栈的深度不做检查，那需要沿着每条跳转路径计算栈的高度，并确认它们在汇合处一致，这里还没有实现。
+// 因此一个构造的文件仍然可以让值栈溢出或下溢，只应载入可信的.salc文件。globals输出全局变量名一节的起始偏移量。
+static bool validate(const uint8_t* data, size_t size, SalcHeader* header, size_t* globals) {
+	if (size < sizeof(SalcHeader)) return false;
+	memcpy(header, data, sizeof(SalcHeader));
+	if (memcmp(header->magic, "SALC", 4) != 0) return false;
+	if (header->version != SALC_VERSION) return false;
+	if (header->size != size) return false;
+	if (header->codeLength == 0 || header->lineCount == 0) return false;
+	if (checksum(data + sizeof(SalcHeader), size - sizeof(SalcHeader)) != header->checksum) return false;
+
+	size_t code = sizeof(SalcHeader) + (size_t)header->lineCount * sizeof(LineStart);
+	size_t offset = alignUp(code + header->codeLength);
+	size_t offsetTable = offset;
+	offset += (size_t)header->constantCount * sizeof(uint32_t);
+	if (offset > size) return false;
+
+	for (uint32_t i = 0; i < header->constantCount; i++) {
+		uint32_t record;
+		memcpy(&record, data + offsetTable + i * sizeof(uint32_t), sizeof(uint32_t));
+		if (record != offset) return false;
+		if (offset >= size) return false;
+		switch (data[offset]) {
+		case CONSTANT_NUMBER:
+			if (size - offset < 1 + sizeof(double)) return false;
+			offset += 1 + sizeof(double);
+			break;
+		case CONSTANT_STRING:
+			offset = checkString(data, size, offset + 1);
+			if (offset == 0) return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	*globals = offset;
+	for (uint32_t i = 0; i < header->globalCount; i++) {
+		offset = checkString(data, size, offset);
+		if (offset == 0) return false;
+	}
+	if (offset != size) return false;
+
+	return validateCode(data + code, header->codeLength, header) && uniqueNames(data, *globals, header->globalCount);
+}
+
+LoadResult loadBytecodeFile(const char* path, BytecodeImage* image, bool quiet) {
+	size_t size;
+	const uint8_t* data = mapFile(path, &size);
+	if (data == NULL) {
+		if (!quiet) fprintf(stderr, "Could not open file \"%s\".\n", path);
+		return LOAD_IO_ERROR;
+	}
+
+	SalcHeader header;
+	size_t globals;
+	if (!validate(data, size, &header, &globals)) {
+		if (!quiet) fprintf(stderr, "Invalid bytecode file \"%s\".\n", path);
+		unmapFile(data, size);
+		return LOAD_INVALID;
+	}
+
+	image->data = data;
+	image->size = size;
+
+	// 字节码和行号表直接指向映射的内存。capacity为0，而image不为NULL，表示这个块并不拥有它们。
+	Chunk* chunk = &image->chunk;
+	initChunk(chunk);
+	chunk->image = data;
+	chunk->lines = (LineStart*)(data + sizeof(SalcHeader));
+	chunk->lineCount = (int)header.lineCount;
+	size_t offset = sizeof(SalcHeader) + (size_t)header.lineCount * sizeof(LineStart);
+	chunk->code = (uint8_t*)(data + offset);
+	chunk->count = (int)header.codeLength;
+	offset = alignUp(offset + header.codeLength);
+	chunk->constantOffsets = (const uint32_t*)(data + offset);
+
+	// 数字常量在这里解码。字符串常量先用UNDEFINED_VAL占位，等虚拟机第一次读到它们时再由loadConstant()驻留。
+	for (uint32_t i = 0; i < header.constantCount; i++) {
+		const uint8_t* record = data + chunk->constantOffsets[i];
+		if (record[0] == CONSTANT_NUMBER) {
+			double number;
+			memcpy(&number, record + 1, sizeof(double));
+			writeValueArray(&chunk->constants, NUMBER_VAL(number), MEM_CONSTANTS);
+		}
+		else {
+			writeValueArray(&chunk->constants, UNDEFINED_VAL, MEM_CONSTANTS);
+		}
+	}
+
+	// 每个全局变量名在文件中的位置就是它的槽号，所以在一个新的虚拟机中注册它们会得到同样的槽号。
+	offset = globals;
+	for (uint32_t i = 0; i < header.globalCount; i++) {
+		uint32_t length;
+		memcpy(&length, data + offset, sizeof(uint32_t));
+		ObjString* name = copyString((const char*)data + offset + sizeof(uint32_t), (int)length);
+		if (declareGlobal(name) != (int)i) {
+			if (!quiet) fprintf(stderr, "Bytecode file \"%s\" must be loaded before any globals are defined.\n", path);
+			unloadBytecodeFile(image);
+			return LOAD_INVALID;
+		}
+		offset += sizeof(uint32_t) + length;
+	}
+
+	return LOAD_OK;
+}
+
+void unloadBytecodeFile(BytecodeImage* image) {
+	freeChunk(&image->chunk);
+	unmapFile(image->data, image->size);
+	image->data = NULL;
+	image->size = 0;
+}
+
+Value loadConstant(Chunk* chunk, int index) {
+	const uint8_t* record = chunk->image + chunk->constantOffsets[index];
+	uint32_t length;
+	memcpy(&length, record + 1, sizeof(uint32_t));
+	Value value = OBJ_VAL(copyString((const char*)record + 1 + sizeof(uint32_t), (int)length));
+	chunk->constants.values[index] = value;
+	return value;
+}
\ No newline at end of file
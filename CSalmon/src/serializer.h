@@ -0,0 +1,40 @@
+#ifndef csalmon_serializer_h
+#define csalmon_serializer_h
+
+#include "chunk.h"
+
+// 每次运行脚本时，我们都要重新扫描并编译整个源文件。对于运行时间很短的脚本来说，编译往往比执行本身还要慢。
+// 所以我们提供一种磁盘上的编译结果格式（.salc文件）：编译一次，之后每次运行都直接载入字节码。
+//
+// 载入时，我们把整个文件映射到内存中，字节码和行号表都直接在映射的内存中使用，不需要复制。
+// 常量表中的数字在载入时就被解码，而字符串常量要等到第一次被用到时才会驻留，这样没有执行到的代码不会带来任何开销。
+// 文件的布局见serializer.cpp。
+
+// 文件格式的版本号。字节码中的操作码编号或操作数格式发生变化时，必须增加它。旧版本的文件会被拒绝载入。
+#define SALC_VERSION 1
+
+// 从.salc文件载入的字节码块，以及它所在的内存映射。
+typedef struct {
+	const uint8_t* data;
+	size_t size;
+	Chunk chunk;
+} BytecodeImage;
+
+typedef enum {
+	LOAD_OK,
+	LOAD_IO_ERROR,		// 文件无法打开或映射。
+	LOAD_INVALID,		// 文件不是（这个版本的）.salc文件，或者内容已经损坏。
+} LoadResult;
+
+// 把编译好的字节码块以及虚拟机当前的全局变量名表写入path。成功时返回true。
+bool writeBytecodeFile(Chunk* chunk, const char* path);
+// 映射并校验path指向的.salc文件。它会按照文件中的顺序注册全局变量名，所以必须在一个还没有定义任何全局变量的虚拟机上调用。
+// quiet为false时，失败的原因会报告到stderr。编译缓存探测缓存项时传入true：损坏的缓存项只是一次未命中，不是用户的错误。
+LoadResult loadBytecodeFile(const char* path, BytecodeImage* image, bool quiet);
+// 释放载入时分配的内存并解除映射。
+void unloadBytecodeFile(BytecodeImage* image);
+
+// 解码并驻留一个还没有载入的字符串常量，把它写回常量表并返回它。虚拟机在读到值为UNDEFINED_VAL的常量时调用它。
+Value loadConstant(Chunk* chunk, int index);
+
+#endif
\ No newline at end of file
@@ -1,68 +1,119 @@
 #include <stdlib.h>
 #include <string.h>
+#include <bit>
 
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
+#include "vm.h"
 
-// 这就是我们管理表负载因子的方式。我们不会在容量全满的时候才进行扩展。相反，当数组达到75%满时，我们会提前扩展数组。
-#define TABLE_MAX_LOAD 0.75
+#ifdef TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+// 桶按组管理，每组16个桶，正好是一个SSE2寄存器能容纳的控制字节数。探测时我们一次检查一整组。
+#define GROUP_SIZE 16
+
+// 控制字节的取值。被占用的桶保存键的哈希码的低7位，最高位总是0；空桶和墓碑的最高位都是1，这样一次比较就能找出一组中所有可以插入的桶。
+#define CONTROL_EMPTY 0x80
+#define CONTROL_DELETED 0xFE
+
+// 这就是我们管理表负载因子的方式。我们不会在容量全满的时候才进行扩展。
+// 因为控制字节让我们在探测时几乎不用读取条目，较长的探测序列代价很小，所以我们允许数组达到7/8满时才扩展。
+static int maxLoad(int capacity) {
+	return capacity - capacity / 8;
+}
+
+// 哈希码的低7位存进控制字节，用来快速排除不匹配的桶；其余的位决定从哪一组开始探测。
+static uint8_t hashTag(uint32_t hash) {
+	return (uint8_t)(hash & 0x7F);
+}
+
+static uint32_t firstGroup(uint32_t hash, int capacity) {
+	return (hash >> 7) & (uint32_t)(capacity / GROUP_SIZE - 1);
+}
+
+// 下面的函数比较一组控制字节，返回一个位掩码：第i位为1表示组中第i个桶符合条件。
+static uint32_t matchTag(const uint8_t* group, uint8_t tag) {
+#ifdef TABLE_SSE2
+	__m128i bytes = _mm_loadu_si128((const __m128i*)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)tag)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		if (group[i] == tag) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+// 空桶或墓碑，也就是可以存放新条目的桶。它们的控制字节最高位为1，而movemask正是收集每个字节的最高位。
+static uint32_t matchAvailable(const uint8_t* group) {
+#ifdef TABLE_SSE2
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < GROUP_SIZE; i++) {
+		if (group[i] & 0x80) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
 
 // 就像动态值数组类型一样，哈希表最初以容量0和NULL数组开始。等到需要的时候我们才会分配一些东西。
 void initTable(Table* table) {
 	table->count = 0;
+	table->tombstones = 0;
 	table->capacity = 0;
+	table->control = NULL;
 	table->entries = NULL;
 }
 
+// 字符串驻留表单独统计，它往往是最大的一张表。
+static MemoryCategory tableCategory(Table* table) {
+	return table == &vm.strings ? MEM_INTERNER : MEM_TABLE;
+}
+
 //
 void freeTable(Table* table) {
-	FREE_ARRAY(Entry, table->entries, table->capacity);
+	forgetTable(table);
+	FREE_ARRAY(tableCategory(table), uint8_t, table->control, table->capacity);
+	FREE_ARRAY(tableCategory(table), Entry, table->entries, table->capacity);
 	initTable(table);
 }
 
-// 它负责接受一个键和一个桶数组，并计算出该条目属于哪个桶。
-// 这个函数也是线性探测和冲突处理发挥作用的地方。我们在查询哈希表中的现有条目以及决定在哪里插入新条目时，都会使用findEntry()方法。
-// 我们会从循环中直接返回，得到一个指向找到的Entry的指针，这样调用方就可以向其中插入内容或从中读取内容。
-// 回到tableSet()——最先调用它的函数，我们将新条目存储到返回的桶中，然后就完成了。
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-	// 首先，我们通过取余操作将键的哈希码映射为数值边界内的一个索引值。这就给了我们一个桶索引，理想情况下，我们可以在这里找到或放置条目。
-	uint32_t index = key->hash % capacity;
-	for (;;) {
-		Entry* entry = &entries[index];
-		Entry* tombstone = NULL;
-		// 如果数组索引处的Entry的键为NULL，则表示桶为空。
-		// 如果我们使用findEntry()在哈希表中查找东西，这意味着它不存在。如果我们用来插入，这表明我们找到了一个可以插入新条目的地方。
-		// 如果桶中的键等于我们要找的，那么这个键已经存在于表中了。
-		// 如果我们在做查找，这很好——我们已经找到了要查找的键。如果我们在做插入，这意味着我们要替换该键的值，而不是添加一个新条目。
-		if (entry->key == NULL) {
-			if (IS_NIL(entry->value)) {
-				// 如果我们遇到一个真正的空条目，那么这个键就不存在。在这种情况下，若我们经过了一个墓碑，就返回它的桶，而不是返回后面的空桶。
-				// 如果我们为了插入一个节点而调用findEntry()，这时我们可以把墓碑桶视为空桶，并重用它来存储新条目。
-				// 像这样自动重用墓碑槽，有助于减少墓碑在桶数组中浪费的空间。在插入与删除混合使用的典型用例中，墓碑的数量会增长一段时间，然后趋于稳定。
-				// 即便如此，也不能保证大量的删除操作不会导致数组中满是墓碑。在最坏的情况下，我们最终可能没有空桶。这是很糟糕的。
-				// 因为，请记住，唯一能阻止findEntry()中无限循环的原因是假设我们最终会命中一个空桶。
-				// 所以我们需要仔细考虑墓碑如何与表的负载因子和大小调整进行互动。
-				return tombstone != NULL ? tombstone : entry;
-			}
-			else {
-				// 当我们在查询中遵循探测序列时，如果遇到了墓碑，我们会记录它并继续前进。
-				// 第一次通过一个墓碑条目时，我们将它存储在这个局部变量中。
-				if (tombstone == NULL) tombstone = entry;
-			}
-		} else if (entry->key == key) {
-			return entry;
+// 探测序列以组为单位：从键的哈希码选出的组开始，第i次探测向后跳过i组（也就是按三角数跳跃），到了数组末端就绕回到起点。
+// 组数总是2的幂，在这种情况下三角数序列恰好会把每一组都访问一遍，所以只要表中还有空桶，探测就一定会结束。
+// 负载因子保证了这一点：被占用的桶和墓碑加起来永远不会超过容量的7/8。
+
+// 查找键所在的桶，返回它的下标，如果键不在表中则返回-1。
+// 在一组中，我们只比较控制字节与键的哈希标记相同的那些桶，通常至多只有一个。
+// 一旦某一组中出现了空桶，键就不可能在更后面的组中，因为插入它的时候，探测会在这一组停下来并使用那个空桶。
+// 墓碑则不会让探测停止，这样删除一个条目不会破坏任何隐式冲突链，我们仍然可以找到它之后的条目。
+static int findEntry(Table* table, ObjString* key) {
+	int groupMask = table->capacity / GROUP_SIZE - 1;
+	uint32_t group = firstGroup(key->hash, table->capacity);
+	uint8_t tag = hashTag(key->hash);
+	for (int step = 1;; step++) {
+		const uint8_t* control = table->control + group * GROUP_SIZE;
+		for (uint32_t match = matchTag(control, tag); match != 0; match &= match - 1) {
+			int index = (int)group * GROUP_SIZE + std::countr_zero(match);
+			if (table->entries[index].key == key) return index;
 		}
+		if (matchTag(control, CONTROL_EMPTY) != 0) return -1;
+		group = (group + step) & groupMask;
+	}
+}
 
-		// 否则，就是桶中有一个条目，但具有不同的键。这就是一个冲突。
-		// 在这种情况下，我们要开始探测。这也就是for循环所做的。我们从条目理想的存放位置开始。如果这个桶是空的或者有相同的键，我们就完成了。
-		// 否则，我们就前进到下一个元素——这就是“线性探测”的线性部分——并进行检查。
-		// 如果我们超过了数组的末端，第二个模运算符就会把我们重新带回起点。
-		// 当我们找到空桶或者与我们要找的桶具有相同键的桶时，我们就退出循环。
-		// 你可能会考虑无限循环的问题。如果我们与所有的桶都冲突怎么办？幸运的是，因为负载因子的原因，这种情况不会发生。
-		// 因为一旦数组接近满。我们就会扩展数组，所以我们知道总是会有空桶。
-		index = (index + 1) % capacity;
+// 找到哈希码对应的探测序列中第一个可以插入的桶。墓碑和空桶一样可以重用，这有助于减少墓碑在桶数组中浪费的空间。
+static int findAvailable(const uint8_t* controls, int capacity, uint32_t hash) {
+	int groupMask = capacity / GROUP_SIZE - 1;
+	uint32_t group = firstGroup(hash, capacity);
+	for (int step = 1;; step++) {
+		uint32_t match = matchAvailable(controls + group * GROUP_SIZE);
+		if (match != 0) return (int)group * GROUP_SIZE + std::countr_zero(match);
+		group = (group + step) & groupMask;
 	}
 }
 
@@ -70,101 +121,135 @@ bool tableGet(Table* table, ObjString* key, Value* value) {
 	// 如果表完全是空的，我们肯定找不到这个条目，所以我们先检查一下。这不仅仅是一种优化——它还确保当数组为NULL时，我们不会试图访问桶数组。
 	if (table->count == 0) return false;
 
-	// 其它情况下，我们就让findEntry()发挥它的魔力。这将返回一个指向桶的指针。
-	// 如果桶是空的（我们通过查看键是否为NULL来检测），那么我们就没有找到包含对应键的Entry。
-	// 如果findEntry()确实返回了一个非空的Entry，那么它就是我们的匹配项。我们获取Entry的值并将其复制到输出参数中，这样调用方就可以得到该值。
-	Entry* entry = findEntry(table->entries, table->capacity, key);
-	if (entry->key == NULL) return false;
+	int index = findEntry(table, key);
+	if (index < 0) return false;
 
-	*value = entry->value;
+	*value = table->entries[index].value;
 	return true;
 }
 
-// 在我们将条目放入哈希表之前，我们确实需要一个地方来实际存储它们。我们需要分配一个桶数组。
+// 当我们调整数组的大小时，我们会分配新的数组，并重新插入所有的现存条目。
+// 在这个过程中，我们不会把墓碑复制过来。因为无论如何我们都要重新构建探测序列，它们不会增加任何价值，而且只会减慢查找速度。
 static void adjustCapacity(Table* table, int capacity) {
-	// 我们创建一个包含capacity个条目的桶数组。
-	Entry* entries = ALLOCATE(Entry, capacity);
-	// 分配完数组后，我们将每个元素初始化为空桶，然后将数组（及其容量）存储到哈希表的主结构体中。
-	for (int i = 0; i < capacity; i++) {
-		entries[i].key = NULL;
-		entries[i].value = NIL_VAL;
-	}
-
-	// 当我们调整数组的大小时，我们会分配一个新数组，并重新插入所有的现存条目。
-	// 在这个过程中，我们不会把墓碑复制过来。因为无论如何我们都要重新构建探测序列，它们不会增加任何价值，而且只会减慢查找速度。
-	// 这意味着我们需要重算计数，因为它可能会在调整大小的期间发生变化。
-	table->count = 0;
+	// 所有桶一开始都是空桶。条目数组不需要初始化，只有控制字节表明被占用的桶才会被读取。
+	uint8_t* control = ALLOCATE(tableCategory(table), uint8_t, capacity);
+	memset(control, CONTROL_EMPTY, capacity);
+	Entry* entries = ALLOCATE(tableCategory(table), Entry, capacity);
 
-	// 请记住，为了给每个条目选择存储桶，我们要用其哈希键与数组大小取模。这意味着，当数组大小发生变化时，条目可能会出现在不同的桶中。
-	// 这些新的桶可能会出现新的冲突，我们需要处理这些冲突。
-	// 因此，获取每个条目所属位置的最简单的方法是从头重新构建哈希表，将每个条目都重新插入到新的空数组中。
-	// 我们从前到后遍历旧数组。
-	// 只要发现一个非空的桶，我们就把这个条目插入到新的数组中。我们使用findEntry()，传入的是新数组，而不是当前存储在哈希表中的旧数组。
 	for (int i = 0; i < table->capacity; i++) {
-		Entry* entry = &table->entries[i];
-		if (entry->key == NULL) continue;
+		if (table->control[i] & 0x80) continue;
 
-		Entry* dest = findEntry(entries, capacity, entry->key);
-		dest->key = entry->key;
-		dest->value = entry->value;
-		// 这意味着，当我们增加容量时，最终在更大的数组中的条目可能会更少，因为所有的墓碑都被丢弃了。这有点浪费，但不是一个严重的实际问题。
-		table->count++;
+		Entry* entry = &table->entries[i];
+		int index = findAvailable(control, capacity, entry->key->hash);
+		control[index] = table->control[i];
+		entries[index] = *entry;
 	}
 
 	// 完成之后，我们就可以释放旧数组的内存。
-	FREE_ARRAY(Entry, table->entries, table->capacity);
+	FREE_ARRAY(tableCategory(table), uint8_t, table->control, table->capacity);
+	FREE_ARRAY(tableCategory(table), Entry, table->entries, table->capacity);
 
+	table->control = control;
 	table->entries = entries;
 	table->capacity = capacity;
+	table->tombstones = 0;
+}
+
+// 表中已经没有可以放入新条目的空桶时，我们重建桶数组。
+// 如果被占用的桶中有很多是墓碑，那么以原来的容量重建就足以腾出空间；只有存活的条目本身已经很多时，我们才把容量翻倍。
+// 这样一来，反复插入和删除的表不会因为墓碑而无限增长。
+static void rehash(Table* table) {
+	int capacity = table->capacity;
+	if (capacity == 0) {
+		capacity = GROUP_SIZE;
+	}
+	else if (table->count + 1 > maxLoad(capacity) / 2) {
+		capacity *= 2;
+	}
+	adjustCapacity(table, capacity);
 }
 
 // 这个函数将给定的键/值对添加到给定的哈希表中。如果该键的条目已存在，新值将覆盖旧值。如果添加了新条目，则该函数返回true。
 bool tableSet(Table* table, ObjString* key, Value value) {
-	// 在我们向其中插入数据之前，需要确保已经有一个数组，而且足够大。
-	// 如果没有足够的容量插入条目，我们就重新分配和扩展数组。
-	// GROW_CAPACITY()宏会接受现有容量，并将其增长一倍，以确保在一系列插入操作中得到摊销的常数性能。
-	if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-		int capacity = GROW_CAPACITY(table->capacity);
-		adjustCapacity(table, capacity);
+	if (table->count > 0) {
+		int index = findEntry(table, key);
+		if (index >= 0) {
+			table->entries[index].value = value;
+			if (IS_YOUNG(value)) rememberEntry(table, key);
+			return false;
+		}
 	}
 
-	// 该函数的作用是接受一个键，并找到它应该放在数组中的哪个桶里。它会返回一个指向该桶的指针——数组中Entry的地址。
-	Entry* entry = findEntry(table->entries, table->capacity, key);
-	// 一旦有了桶，插入就很简单了。我们更新哈希表的大小，如果我们覆盖了一个已经存在的键的值，注意不要增加计数。
-	bool isNewKey = entry->key == NULL;
-	// 如果我们用新条目替换墓碑，因为这个桶已经被统计过了，所以计数不会改变。
-	if (isNewKey && IS_NIL(entry->value)) table->count++;
+	// 重用墓碑不会增加负载，只有占用一个空桶才需要检查是否要重建数组。
+	int index = table->capacity == 0 ? -1 : findAvailable(table->control, table->capacity, key->hash);
+	if (index < 0 || (table->control[index] == CONTROL_EMPTY && table->count + table->tombstones + 1 > maxLoad(table->capacity))) {
+		rehash(table);
+		index = findAvailable(table->control, table->capacity, key->hash);
+	}
 
-	// 然后，我们将键和值复制到Entry中的对应字段中。
-	entry->key = key;
-	entry->value = value;
-	return isNewKey;
+	if (table->control[index] == CONTROL_DELETED) table->tombstones--;
+	table->control[index] = hashTag(key->hash);
+	table->entries[index].key = key;
+	table->entries[index].value = value;
+	table->count++;
+	// 写屏障：年轻的键或值存入了表中。
+	if (isYoungObject((Obj*)key) || IS_YOUNG(value)) rememberEntry(table, key);
+	return true;
 }
 
-// 如果我们通过简单地清除Entry来删除“biscuit”，那么我们就会中断探测序列，让后面的条目变得孤立、不可访问。
-// 这有点像是从链表中删除了一个节点，而没有把指针从上一个节点重新链接到下一个节点。
-// 为了解决这个问题，大多数实现都使用了一个叫作墓碑的技巧。我们不会在删除时清除条目，而是将其替换为一个特殊的哨兵条目，称为“墓碑”。
-// 当我们在查找过程中顺着探测序列遍历时，如果遇到墓碑，我们不会把它当作是空槽而停止遍历。
-// 相反，我们会继续前进，这样删除一个条目不会破坏任何隐式冲突链，我们仍然可以找到它之后的条目。
+// 如果我们通过简单地清空桶来删除“biscuit”，那么我们就可能中断探测序列，让后面的条目变得孤立、不可访问。
+// 为了解决这个问题，大多数实现都使用了一个叫作墓碑的技巧。我们不会在删除时清空桶，而是将其标记为一个特殊的哨兵，称为“墓碑”。
+// 不过，如果被删除的桶所在的组中还有空桶，那么任何探测序列都会在这一组停下来，不会越过它去找后面的组，这时直接把桶标记为空桶是安全的。
 bool tableDelete(Table* table, ObjString* key) {
 	if (table->count == 0) return false;
 
 	// 首先，我们找到包含待删除条目的桶（如果我们没有找到，就没有什么可删除的，所以我们退出）。
-	Entry* entry = findEntry(table->entries, table->capacity, key);
-	if (entry->key == NULL) return false;
+	int index = findEntry(table, key);
+	if (index < 0) return false;
 
-	// 我们将该条目替换为墓碑。在clox中，我们使用NULL键和true值来表示，但任何不会与空桶或有效条目相混淆的表示形式都是可行的。
-	entry->key = NULL;
-	entry->value = BOOL_VAL(true);
+	const uint8_t* group = table->control + (index & ~(GROUP_SIZE - 1));
+	if (matchTag(group, CONTROL_EMPTY) != 0) {
+		table->control[index] = CONTROL_EMPTY;
+	}
+	else {
+		table->control[index] = CONTROL_DELETED;
+		table->tombstones++;
+	}
+	table->count--;
 	return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
 	for (int i = 0; i < from->capacity; i++) {
+		if (from->control[i] & 0x80) continue;
 		Entry* entry = &from->entries[i];
-		if (entry->key != NULL) {
-			tableSet(to, entry->key, entry->value);
-		}
+		tableSet(to, entry->key, entry->value);
+	}
+}
+
+Entry* tableFindEntry(Table* table, ObjString* key) {
+	if (table->count == 0) return NULL;
+	int index = findEntry(table, key);
+	return index < 0 ? NULL : &table->entries[index];
+}
+
+void markTable(Table* table) {
+	for (int i = 0; i < table->capacity; i++) {
+		if (table->control[i] & 0x80) continue;
+		Entry* entry = &table->entries[i];
+		markObject((Obj*)entry->key);
+		markValue(entry->value);
+	}
+}
+
+// 字符串表不能让字符串保持存活，否则任何字符串都不会被回收。所以在清除阶段之前，我们删除所有即将被释放的字符串，免得表中留下悬空指针。
+// 这里只是修改控制字节，不会分配内存，所以在回收过程中调用它是安全的。
+void tableRemoveWhite(Table* table) {
+	for (int i = 0; i < table->capacity; i++) {
+		if (table->control[i] & 0x80) continue;
+		// 年轻的字符串由次要回收处理。
+		if (isYoungObject((Obj*)table->entries[i].key)) continue;
+		if (!table->entries[i].key->obj.isMarked) tableDelete(table, table->entries[i].key);
 	}
 }
 
@@ -172,22 +257,24 @@ void tableAddAll(Table* from, Table* to) {
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
 	if (table->count == 0) return NULL;
 
-	uint32_t index = hash % table->capacity;
-	for (;;) {
-		Entry* entry = &table->entries[index];
-		if (entry->key == NULL) {
-			// Stop if we find an empty non-tombstone entry.
-			if (IS_NIL(entry->value)) return NULL;
-		}
-		// 其次，在检查是否找到键时，我们要看一下实际的字符串。
-		// 我们首先看看它们的长度和哈希值是否匹配。这些都是快速检查，如果它们不相等，那些字符串肯定不一样。
-		// 如果存在哈希冲突，我们就进行实际的逐字符的字符串比较。这是虚拟机中我们真正测试字符串是否相等的一个地方。
-		// 我们在这里这样做是为了对字符串去重，然后虚拟机的其它部分可以想当然地认为，内存中不同地址的任意两个字符串一定有着不同的内容。
-		else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
-			// We found it.
-			return entry->key;
+	int groupMask = table->capacity / GROUP_SIZE - 1;
+	uint32_t group = firstGroup(hash, table->capacity);
+	uint8_t tag = hashTag(hash);
+	for (int step = 1;; step++) {
+		const uint8_t* control = table->control + group * GROUP_SIZE;
+		for (uint32_t match = matchTag(control, tag); match != 0; match &= match - 1) {
+			// 其次，在检查是否找到键时，我们要看一下实际的字符串。
+			// 我们首先看看它们的长度和哈希值是否匹配。这些都是快速检查，如果它们不相等，那些字符串肯定不一样。
+			// 如果存在哈希冲突，我们就进行实际的逐字符的字符串比较。这是虚拟机中我们真正测试字符串是否相等的一个地方。
+			// 我们在这里这样做是为了对字符串去重，然后虚拟机的其它部分可以想当然地认为，内存中不同地址的任意两个字符串一定有着不同的内容。
+			ObjString* key = table->entries[(int)group * GROUP_SIZE + std::countr_zero(match)].key;
+			if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0) {
+				// We found it.
+				return key;
+			}
 		}
-
-		index = (index + 1) % table->capacity;
+		// Stop if we find an empty non-tombstone entry.
+		if (matchTag(control, CONTROL_EMPTY) != 0) return NULL;
+		group = (group + step) & groupMask;
 	}
 }
\ No newline at end of file
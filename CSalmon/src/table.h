@@ -40,11 +40,15 @@ typedef struct {
 	Value value;
 } Entry;
 
-// 哈希表是一个条目数组。就像前面的动态数组一样，我们既要跟踪数组的分配大小（容量，capacity）和当前存储在其中的键/值对数量（计数，count）。
-// 数量与容量的比值正是哈希表的负载因子。
+// 哈希表由两个平行的数组组成：条目数组，以及每个桶一个字节的控制字节数组。控制字节记录桶的状态：空桶、墓碑，或者已被占用。
+// 被占用的桶的控制字节保存键的哈希码的低7位。探测时我们一次比较一整组（16个）控制字节，只有控制字节匹配的桶才需要读出条目并比较键，
+// 所以探测过程中绝大多数不匹配的桶根本不会触及条目数组。就像前面的动态数组一样，我们要跟踪数组的分配大小（容量，capacity）和当前存储在其中的键/值对数量（计数，count）。
+// 墓碑不是存活的条目，但它们同样占用桶，所以负载因子是（count + tombstones）与容量的比值。
 typedef struct {
 	int count;
-	int capacity;
+	int tombstones;
+	int capacity;		// 总是0或者一组的大小乘以2的幂，这样我们可以用位掩码代替取模来选择组。
+	uint8_t* control;
 	Entry* entries;
 } Table;
 
@@ -60,4 +64,11 @@ void tableAddAll(Table* from, Table* to);
 // 要在表中查找字符串，我们不能使用普通的tableGet()函数，因为它调用了findEntry()，这正是我们现在试图解决的重复字符串的问题。
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
 
+// 返回键为key的条目，如果键不在表中则返回NULL。次要回收用它来更新写屏障记录下来的条目。
+Entry* tableFindEntry(Table* table, ObjString* key);
+
+// 垃圾回收器使用的两个函数。markTable()标记表中所有的键和值；tableRemoveWhite()删除键没有被标记的条目，用于弱引用的字符串表。
+void markTable(Table* table);
+void tableRemoveWhite(Table* table);
+
 #endif
\ No newline at end of file
@@ -12,23 +12,34 @@ void initValueArray(ValueArray* array) {
 	array->count = 0;
 }
 
-void writeValueArray(ValueArray* array, Value value) {
+void writeValueArray(ValueArray* array, Value value, MemoryCategory category) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(oldCapacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(category, Value, array->values, oldCapacity, array->capacity);
     }
 
     array->values[array->count] = value;
     array->count++;
 }
 
-void freeValueArray(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+void freeValueArray(ValueArray* array, MemoryCategory category) {
+    forgetArray(array);
+    FREE_ARRAY(category, Value, array->values, array->capacity);
     initValueArray(array);
 }
 
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    // 在NaN装箱的表示中，除了数字之外，两个值相等当且仅当它们的位完全相同：单例值只有一种编码，驻留的字符串共享同一个指针。
+    // 数字则必须按double来比较，这样NaN才会不等于它自己，而0和-0才会相等，与带标签的联合体表示中的行为保持一致。
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    // 还没有驻留的长字符串（ObjBuilder）例外，它们需要比较内容。
+    if (IS_OBJ(a) && IS_OBJ(b)) return objectsEqual(AS_OBJ(a), AS_OBJ(b));
+    return a == b;
+#else
     // 首先，我们检查类型。如果两个Value的类型不同，它们肯定不相等。否则，我们就把这两个Value拆装并直接进行比较。
     if (a.type != b.type) return false;
     // 对于每一种值类型，我们都有一个单独的case分支来处理值本身的比较。
@@ -41,14 +52,34 @@ bool valuesEqual(Value a, Value b) {
     // 在创建字符串时，我们增加了一点开销来进行驻留。但作为回报，在运行时，字符串的相等操作符要快得多。
     // 在Lox这样的动态类型语言中，这一点更为关键，因为在这种语言中，方法调用和实例属性都是在运行时根据名称查找的。
     // 如果测试字符串是否相等是很慢的，那就意味着按名称查找方法也很慢。在面向对象的语言中，如果这一点很慢，那么一切都会变得很慢。
-    case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+    // 还没有驻留的长字符串（ObjBuilder）例外，它们需要比较内容。
+    case VAL_OBJ:    return objectsEqual(AS_OBJ(a), AS_OBJ(b));
 
     default:         return false; // Unreachable.
     }
+#endif
 }
 
 //
 void printValue(Value value) {
+#ifdef NAN_BOXING
+    // 没有类型标签可以switch，所以我们依次检查每一种类型。
+    if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    }
+    else if (IS_NIL(value)) {
+        printf("nil");
+    }
+    else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    }
+    else if (IS_OBJ(value)) {
+        printObject(value);
+    }
+    else if (IS_UNDEFINED(value)) {
+        printf("<undefined>");
+    }
+#else
     switch (value.type) {
     case VAL_BOOL:
         printf(AS_BOOL(value) ? "true" : "false");
@@ -56,5 +87,7 @@ void printValue(Value value) {
     case VAL_NIL: printf("nil"); break;
     case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
     case VAL_OBJ: printObject(value); break;
+    case VAL_UNDEFINED: printf("<undefined>"); break;
     }
+#endif
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef csalmon_value_h
 #define csalmon_value_h
 
+#include <string.h>
+
 #include "common.h"
 
 // “Obj”这个名称本身指的是一个结构体，它包含所有对象类型共享的状态。它有点像对象的“基类”。
@@ -8,6 +10,61 @@ typedef struct Obj Obj;
 // 字符串的有效载荷定义在一个单独的结构体中。同样，我们需要对其进行前置声明。
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+
+// NaN装箱把每个Value都压缩成一个64位的字。一个double只要指数位全为1、尾数最高位（“静默”位）为1，就是一个静默NaN，
+// 剩下的51个尾数位硬件并不关心，我们就用它们来存储其它类型的值。真正的NaN运算结果总是同一个规范的静默NaN，不会与我们的编码冲突。
+// 所以栈、常量表和哈希表里的每个槽都从16字节变成了8字节，内存访问量减半。
+// 
+// 所有的位都设置在静默NaN的位置上，再加上Intel的“QNaN浮点不确定”值使用的那一位，以避开它。
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+// 符号位被设置的静默NaN代表一个对象指针，低48位就是指针本身。在目前所有的64位平台上，用户空间的地址都放得下这48位。
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+
+// 单例值nil、true、false以及“未定义”哨兵值，各自使用静默NaN的最低几位中的一个不同的标签。
+#define TAG_NIL       1	// 01.
+#define TAG_FALSE     2	// 10.
+#define TAG_TRUE      3	// 11.
+#define TAG_UNDEFINED 4	// 100.
+
+typedef uint64_t Value;
+
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define OBJ_VAL(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+#define NUMBER_VAL(num)   numToValue(num)
+#define UNDEFINED_VAL     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_OBJ(value)     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+#define AS_NUMBER(value)  valueToNum(value)
+
+// 只有true和false在与1按位或之后会等于TRUE_VAL。
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_OBJ(value)     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+// 任何不是静默NaN的值都是一个数字。
+#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+// 在double和它的位模式之间转换时，我们使用memcpy()而不是指针转换或联合体，这是唯一不违反严格别名规则的做法。
+// 编译器会把它优化成一次寄存器之间的移动。
+static inline double valueToNum(Value value) {
+	double num;
+	memcpy(&num, &value, sizeof(Value));
+	return num;
+}
+
+static inline Value numToValue(double num) {
+	Value value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
+
 // 现在，我们将从最简单、最经典的解决方案开始：带标签的联合体。
 // 一个值包含两个部分：一个类型“标签”，和一个实际值的有效载荷。为了存储值的类型，我们要为虚拟机支持的每一种值定义一个枚举。
 typedef enum {
@@ -15,6 +72,8 @@ typedef enum {
 	VAL_NIL,
 	VAL_NUMBER,
 	VAL_OBJ,	// 每个状态位于堆上的Lox值都是一个Obj。
+	// 这个类型只在虚拟机内部使用，用户代码永远看不到它。已经分配了槽但还没有被定义的全局变量持有这个哨兵值。
+	VAL_UNDEFINED,
 } ValueType;
 
 // 这个类型定义抽象了Salmon值在C语言中的具体表示方式。这样，我们就可以直接改变表示方法，而不需要回去修改现有的传递值的代码。
@@ -44,6 +103,7 @@ typedef struct {
 #define NIL_VAL           (Value{VAL_NIL, {.number = 0}})
 #define OBJ_VAL(object)   (Value{VAL_OBJ, {.obj = (Obj*)object}})
 #define NUMBER_VAL(value) (Value{VAL_NUMBER, {.number = value}})
+#define UNDEFINED_VAL     (Value{VAL_UNDEFINED, {.number = 0}})
 // 但是为了能对Value做任何操作，我们需要将其拆包并取出对应的C值。
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_OBJ(value)     ((value).as.obj)
@@ -54,6 +114,9 @@ typedef struct {
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
+
+#endif
 
 // ------------------常量池------------------
 // 常量池是一个值的数组。加载常量的指令根据数组中的索引查找该数组中的值。
@@ -65,8 +128,9 @@ typedef struct {
 } ValueArray;
 
 void initValueArray(ValueArray* array);
-void writeValueArray(ValueArray* array, Value value);
-void freeValueArray(ValueArray* array);
+// category是数组所占内存的分类（常量表或全局变量），同一个数组每次都要给出相同的分类。
+void writeValueArray(ValueArray* array, Value value, MemoryCategory category);
+void freeValueArray(ValueArray* array, MemoryCategory category);
 
 // ------------------------------------
 bool valuesEqual(Value a, Value b);
@@ -1,12 +1,18 @@
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <array>
+#include <utility>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
 #include "object.h"
 #include "memory.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "serializer.h"
 #include "vm.h"
 
 // 我们声明了一个全局VM对象。反正我们只需要一个虚拟机对象，这样可以让本书中的代码在页面上更轻便。
@@ -31,31 +37,111 @@ static void runtimeError(const char* format, ...) {
 	// 在显示了希望有帮助的错误信息之后，我们还会告诉用户，当错误发生时正在执行代码中的哪一行。
 	// 因为我们在编译器中留下了标识，所以我们可以从编译到字节码块中的调试信息中查找行号。
 	// 如果我们的编译器正确完成了它的工作，就能对应到字节码被编译出来的那一行源代码。
-	// 我们使用当前字节码指令索引减1来查看字节码块的调试行数组。这是因为解释器在之前每条指令之前都会向前推进。
+	// 我们使用当前字节码指令索引减1来查看字节码块的行号表。这是因为解释器在之前每条指令之前都会向前推进。
 	// 所以，当我们调用 runtimeError()，失败的指令就是前一条。
 	size_t instruction = vm.ip - vm.chunk->code - 1;
-	int line = vm.chunk->lines[instruction];
+	int line = getLine(vm.chunk, (int)instruction);
 	fprintf(stderr, "[line %d] in script\n", line);
 	resetStack();
 }
 
 void initVM() {
 	resetStack();
+	// 调试输出默认是关闭的，由main()根据命令行标志打开。
+	vm.traceExecution = false;
+	vm.printCode = false;
+	vm.printStats = false;
+	vm.profile = false;
+	vm.sampling = false;
+	vm.sampledIp = NULL;
+	vm.dispatchCount = 0;
+	vm.codeBytes = 0;
+	vm.lineTableBytes = 0;
+	vm.cacheHits = 0;
+	vm.cacheMisses = 0;
+	vm.cacheEvictions = 0;
+	// 窥孔优化默认是打开的。
+	vm.peephole = true;
 	// 当我们第一次初始化VM时，没有分配的对象。
 	vm.objects = NULL;
+	vm.chunk = NULL;
+	vm.bytesAllocated = 0;
+	vm.nextGC = GC_INITIAL_HEAP;
+	memset(vm.memory, 0, sizeof(vm.memory));
+	vm.peakBytesAllocated = 0;
+	vm.printMemoryStats = false;
+	vm.stressGC = false;
+	vm.grayCount = 0;
+	vm.grayCapacity = 0;
+	vm.grayStack = NULL;
+	vm.nurseryStart = (char*)malloc(NURSERY_SIZE);
+	if (vm.nurseryStart == NULL) exit(1);
+	vm.nurseryTop = vm.nurseryStart;
+	vm.nurseryEnd = vm.nurseryStart + NURSERY_SIZE;
+	vm.nurseryFull = false;
+	vm.rememberedSlots = NULL;
+	vm.rememberedSlotCount = 0;
+	vm.rememberedSlotCapacity = 0;
+	vm.rememberedEntries = NULL;
+	vm.rememberedEntryCount = 0;
+	vm.rememberedEntryCapacity = 0;
+	vm.minorCollections = 0;
+	vm.majorCollections = 0;
 	// 我们需要在虚拟机启动时将哈希表初始化为有效状态。
 	initTable(&vm.globals);
+	initValueArray(&vm.globalValues);
+	initValueArray(&vm.globalNames);
+	initValueArray(&vm.hostRoots);
 	// 当我们启动一个新的虚拟机时，字符串表是空的。
 	initTable(&vm.strings);
+	vm.sources = NULL;
+	vm.sourceCount = 0;
+	vm.sourceCapacity = 0;
 }
 
 void freeVM() {
+	// 报告的是脚本结束时的内存使用，所以要在释放任何东西之前打印。
+	if (vm.printMemoryStats) printMemoryStats();
 	freeTable(&vm.globals);
+	freeValueArray(&vm.globalValues, MEM_GLOBALS);
+	freeValueArray(&vm.globalNames, MEM_GLOBALS);
+	freeValueArray(&vm.hostRoots, MEM_OTHER);
 	// 而当我们关闭虚拟机时，我们要清理该表使用的所有资源。
 	freeTable(&vm.strings);
 	// 一旦程序完成，我们就可以释放每个对象。我们现在可以也应该实现它。
 	// 像一个好的C程序一样，它会在退出之前进行清理。但在虚拟机运行时，它不会释放任何对象。
 	freeObjects();
+	freeNursery();
+	free(vm.grayStack);
+	// 借用源代码的字符串都已经释放了，现在可以释放源代码本身。
+	for (int i = 0; i < vm.sourceCount; i++) free(vm.sources[i].chars);
+	FREE_ARRAY(MEM_OTHER, RetainedSource, vm.sources, vm.sourceCapacity);
+	// 现在所有的内存都已经还给了内存池，可以释放它的内存页了。
+	freeAllocator();
+	// 此时每个分类都应该归零了，否则就是有内存泄漏。
+	if (vm.printMemoryStats && vm.bytesAllocated != 0) {
+		fprintf(stderr, "leaked %zu bytes at shutdown\n", vm.bytesAllocated);
+	}
+}
+
+void retainSource(char* source) {
+	if (vm.sourceCapacity < vm.sourceCount + 1) {
+		int oldCapacity = vm.sourceCapacity;
+		vm.sourceCapacity = GROW_CAPACITY(oldCapacity);
+		vm.sources = GROW_ARRAY(MEM_OTHER, RetainedSource, vm.sources, oldCapacity, vm.sourceCapacity);
+	}
+	vm.sources[vm.sourceCount].chars = source;
+	vm.sources[vm.sourceCount].length = strlen(source);
+	vm.sourceCount++;
+}
+
+bool isRetainedSource(const char* chars) {
+	// 正在编译的通常是最后交给虚拟机的那块源代码（例如REPL刚刚读入的一行），所以我们从后往前找。
+	for (int i = vm.sourceCount - 1; i >= 0; i--) {
+		const char* start = vm.sources[i].chars;
+		if (chars >= start && chars < start + vm.sources[i].length) return true;
+	}
+	return false;
 }
 
 void push(Value value) {
@@ -81,31 +167,107 @@ static bool isFalsey(Value value) {
 	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+int declareGlobal(ObjString* name) {
+	Value slot;
+	if (tableGet(&vm.globals, name, &slot)) {
+		return (int)AS_NUMBER(slot);
+	}
+
+	int index = vm.globalValues.count;
+	if (index == UINT16_COUNT) return -1;
+	// 在名称存入globalNames之前，扩展数组时触发的垃圾回收可能会释放它，所以我们暂时把它压入栈中。
+	push(OBJ_VAL(name));
+	writeValueArray(&vm.globalValues, UNDEFINED_VAL, MEM_GLOBALS);
+	writeValueArray(&vm.globalNames, OBJ_VAL(name), MEM_GLOBALS);
+	tableSet(&vm.globals, name, NUMBER_VAL((double)index));
+	pop();
+	return index;
+}
+
+// 从.salc文件载入的块中，字符串常量在第一次被读到之前都是UNDEFINED_VAL。编译出来的块中永远不会有这样的常量，所以这个分支总是可以被正确预测。
+static inline Value readConstant(int index) {
+	Value value = vm.chunk->constants.values[index];
+	if (IS_UNDEFINED(value)) value = loadConstant(vm.chunk, index);
+	return value;
+}
+
+// 全局变量的写屏障。循环中反复把同一个年轻对象存入不同的全局变量时，记录会一直增加，而没有新的分配就不会有次要回收来清空它们。
+// 所以记录太多时在这里进行一次次要回收。这里是安全点：要存入的值还在栈上，回收移动它之后栈上的值和槽中的值都会被更新。
+// 回收之后这个对象已经在老年代中，以后再存入它就不需要记录了。
+static inline void rememberGlobal(uint16_t slot) {
+	rememberSlot(&vm.globalValues, slot);
+	if (vm.rememberedSlotCount >= REMEMBERED_SET_LIMIT) collectNursery();
+}
+
 static void concatenate() {
-	ObjString* b = AS_STRING(pop());
-	ObjString* a = AS_STRING(pop());
-
-	// 首先，我们根据操作数的长度计算结果字符串的长度。
-	// 我们为结果分配一个字符数组，然后将两个部分复制进去。与往常一样，我们要小心地确保这个字符串被终止了。
-	int length = a->length + b->length;
-	char* chars = ALLOCATE(char, length + 1);
-	memcpy(chars, a->chars, a->length);
-	memcpy(chars + a->length, b->chars, b->length);
-	chars[length] = '\0';
-
-	// 最后，我们生成一个ObjString来包含这些字符。这次我们使用一个新函数takeString()。
-	ObjString* result = takeString(chars, length);
+	// 这里是次要回收的安全点：两个操作数都在栈上，回收移动它们之后栈上的值会被更新。
+	if (vm.nurseryFull || vm.stressGC) collectNursery();
+
+	// 分配结果时可能会触发垃圾回收，所以在结果创建出来之前，两个操作数要一直留在栈上。
+	Obj* b = AS_OBJ(peek(0));
+	Obj* a = AS_OBJ(peek(1));
+
+	// 结果字符串的哈希值由两个操作数的哈希值算出，所以在循环中不断加长一个字符串时，哈希的开销不会随着字符串变长而增长。
+	// 较长的结果是一个ObjBuilder，在循环中不断地向它追加时，复制的开销也不会随着字符串变长而增长。
+	Obj* result = appendString(a, b);
+	pop();
+	pop();
 	push(OBJ_VAL(result));
 }
 
+// 每当我们追踪执行情况时，我们也会在解释每条指令之前展示栈中的当前内容。
+// 这段代码原本直接写在分派循环的开头，但线程化分派的每个操作码处理程序末尾都有自己的分派点，所以我们把它提取成一个函数。
+static void traceExecution(uint8_t* ip) {
+	printf("          ");
+	// 我们循环打印数组中的每个值，从第一个值开始（栈底），到栈顶结束。这样我们可以观察到每条指令对栈的影响。
+	for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+		printf("[ ");
+		printValue(*slot);
+		printf(" ]");
+	}
+	printf("\n");
+
+	// 由于 disassembleInstruction() 方法接收一个整数offset作为字节偏移量，而我们将当前指令引用存储为一个直接指针，
+	// 所以我们首先要做一个小小的指针运算，将ip转换成从字节码开始的相对偏移量。
+	disassembleInstruction(vm.chunk, (int)(ip - vm.chunk->code));
+}
+
+// 解释器循环的每份实例都由一组编译期标志决定。
+// RUN_TRACE在执行每条指令之前反汇编并打印它，RUN_COUNT统计分派的次数，供--stats报告使用，RUN_PROFILE为--profile统计并抽样计时每个操作码，
+// RUN_SAMPLE为--sample-profile公开指令指针。
+typedef enum {
+	RUN_TRACE = 1 << 0,
+	RUN_COUNT = 1 << 1,
+	RUN_PROFILE = 1 << 2,
+	RUN_SAMPLE = 1 << 3,
+	RUN_FLAG_COMBINATIONS = 1 << 4,
+} RunFlags;
+
+// 这些标志都是编译期常量。在没有打开任何标志的实例中，这个函数体是空的，所以分派循环里不会留下任何调试分支。
+template <int Flags>
+static inline void beforeInstruction(uint8_t* ip) {
+	if constexpr ((Flags & RUN_TRACE) != 0) traceExecution(ip);
+	if constexpr ((Flags & RUN_COUNT) != 0) vm.dispatchCount++;
+	if constexpr ((Flags & RUN_PROFILE) != 0) profileInstruction(*ip);
+	if constexpr ((Flags & RUN_SAMPLE) != 0) vm.sampledIp = ip;
+}
+
+// 解释器循环以这组标志为模板参数，每种组合都被实例化为单独的一份。
+// interpret()根据命令行标志在运行时选择其中一份，这样生产环境的运行不必为调试付出代价，而追踪和统计仍然可以随时按需打开。
+template <int Flags>
 static InterpretResult run() {
+	// 指令指针是分派循环中最热的变量，每条指令都要读写它好几次。
+	// 如果直接使用vm.ip，C编译器就必须在每次分派时把它写回内存再读出来，这会把一次存储-加载转发放到每条指令的关键路径上。
+	// 所以我们把它缓存在一个局部变量中，让编译器可以把它放在寄存器里。只有在报告运行时错误之前，才需要把它写回vm.ip。
+	uint8_t* ip = vm.ip;
+
 	// 为了使作用域更明确，宏定义本身要被限制在该函数中。我们在开始时定义了它们，然后因为我们比较关心，在结束时取消它们的定义。
 	// READ_BYTE这个宏会读取ip当前指向字节，然后推进指令指针。
-#define READ_BYTE() (*vm.ip++)
+#define READ_BYTE() (*ip++)
 	// READ_CONTANT()从字节码中读取下一个字节，将得到的数字作为索引，并在代码块的常量表中查找相应的Value。
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+#define READ_CONSTANT() readConstant(READ_BYTE())
 	// 它从字节码块中抽取接下来的两个字节，并从中构建出一个16位无符号整数。
-#define READ_SHORT() (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 	// 它从字节码块中读取一个1字节的操作数。它将其视为字节码块的常量表的索引，并返回该索引处的字符串。
 	// 它不检查该值是否是字符串——它只是不加区分地进行类型转换。这是安全的，因为编译器永远不会发出引用非字符串常量的指令。
 #define READ_STRING() AS_STRING(READ_CONSTANT())
@@ -115,6 +277,7 @@ static InterpretResult run() {
 #define BINARY_OP(valueType, op) \
     do { \
       if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+        vm.ip = ip; \
         runtimeError("Operands must be numbers."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
@@ -123,100 +286,148 @@ static InterpretResult run() {
       push(valueType(a op b)); \
     } while (false)
 
-	// 我们有一个不断进行的外层循环。每次循环中，我们会读取并执行一条字节码指令。
-	for (;;) {
-		// 定义了这个标志之后，虚拟机在执行每条指令之前都会反汇编并将其打印出来。
-		// 每当我们追踪执行情况时，我们也会在解释每条指令之前展示栈中的当前内容。
-#ifdef DEBUG_TRACE_EXECUTION
-		printf("          ");
-		// 我们循环打印数组中的每个值，从第一个值开始（栈底），到栈顶结束。这样我们可以观察到每条指令对栈的影响。
-		for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-			printf("[ ");
-			printValue(*slot);
-			printf(" ]");
-		}
-		printf("\n");
+#define TRACE_EXECUTION() beforeInstruction<Flags>(ip)
+
+	// 指令分派有两种实现方式，它们共享下面同一份操作码处理代码，区别只在于这几个宏如何展开。
+	// 可移植的方式是一个外层循环加一个switch语句：所有指令都从同一个间接跳转分派出去，CPU的分支预测器只能为它记住一个目标，
+	// 而在循环密集的脚本中，下一条指令几乎总是由当前指令决定的，这个共享的跳转就会不断地预测失败。
+	// 线程化分派则让每个操作码处理程序的末尾都有一个自己的间接跳转，直接跳到下一条指令的处理程序。
+	// 这样，每个跳转都可以单独被预测，比如OP_LOOP之后总是OP_GET_LOCAL。它依赖GCC和Clang的“标签作为值”扩展（&&label）。
+#ifdef COMPUTED_GOTO
+	// 分派表按操作码的值索引对应处理程序标签的地址。我们按操作码逐一填充它，这样它就不依赖于Opcode枚举的声明顺序。
+	// 编译器从不生成未知的操作码，但为了与switch版本的行为一致，我们把表中其余的槽都指向一个直接分派下一条指令的标签。
+	static void* dispatchTable[UINT8_COUNT];
+	if (dispatchTable[OP_RETURN] == NULL) {
+		for (int i = 0; i < UINT8_COUNT; i++) dispatchTable[i] = &&op_UNKNOWN;
+		dispatchTable[OP_PRINT] = &&op_OP_PRINT;
+		dispatchTable[OP_JUMP] = &&op_OP_JUMP;
+		dispatchTable[OP_JUMP_IF_FALSE] = &&op_OP_JUMP_IF_FALSE;
+		dispatchTable[OP_LOOP] = &&op_OP_LOOP;
+		dispatchTable[OP_RETURN] = &&op_OP_RETURN;
+		dispatchTable[OP_CONSTANT] = &&op_OP_CONSTANT;
+		dispatchTable[OP_NIL] = &&op_OP_NIL;
+		dispatchTable[OP_TRUE] = &&op_OP_TRUE;
+		dispatchTable[OP_FALSE] = &&op_OP_FALSE;
+		dispatchTable[OP_POP] = &&op_OP_POP;
+		dispatchTable[OP_GET_LOCAL] = &&op_OP_GET_LOCAL;
+		dispatchTable[OP_SET_LOCAL] = &&op_OP_SET_LOCAL;
+		dispatchTable[OP_GET_GLOBAL] = &&op_OP_GET_GLOBAL;
+		dispatchTable[OP_DEFINE_GLOBAL] = &&op_OP_DEFINE_GLOBAL;
+		dispatchTable[OP_SET_GLOBAL] = &&op_OP_SET_GLOBAL;
+		dispatchTable[OP_EQUAL] = &&op_OP_EQUAL;
+		dispatchTable[OP_GREATER] = &&op_OP_GREATER;
+		dispatchTable[OP_LESS] = &&op_OP_LESS;
+		dispatchTable[OP_ADD] = &&op_OP_ADD;
+		dispatchTable[OP_SUBTRACT] = &&op_OP_SUBTRACT;
+		dispatchTable[OP_MULTIPLY] = &&op_OP_MULTIPLY;
+		dispatchTable[OP_DIVIDE] = &&op_OP_DIVIDE;
+		dispatchTable[OP_NOT] = &&op_OP_NOT;
+		dispatchTable[OP_NEGATE] = &&op_OP_NEGATE;
+		dispatchTable[OP_ADD_LOCALS] = &&op_OP_ADD_LOCALS;
+		dispatchTable[OP_LESS_JUMP_IF_FALSE] = &&op_OP_LESS_JUMP_IF_FALSE;
+		dispatchTable[OP_ADD_CONSTANT] = &&op_OP_ADD_CONSTANT;
+	}
 
-		// 由于 disassembleInstruction() 方法接收一个整数offset作为字节偏移量，而我们将当前指令引用存储为一个直接指针，
-		// 所以我们首先要做一个小小的指针运算，将ip转换成从字节码开始的相对偏移量。
-		disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+	// DISPATCH()读取下一条指令的操作码，并直接跳转到它的处理程序。每个处理程序都以一次DISPATCH()结束，而不是回到循环顶部。
+#define DISPATCH() \
+    do { \
+      TRACE_EXECUTION(); \
+      goto *dispatchTable[READ_BYTE()]; \
+    } while (false)
+#define INTERPRET_LOOP DISPATCH();
+#define CASE(name) op_##name:
+#define NEXT DISPATCH()
+#else
+	// 我们有一个不断进行的外层循环。每次循环中，我们会读取并执行一条字节码指令。
+	// 为了处理一条指令，我们首先需要弄清楚要处理的是哪种指令。READ_BYTE这个宏会读取ip当前指向字节，然后推进指令指针。
+	// 任何指令的第一个字节都是操作码。给定一个操作码，我们需要找到实现该指令语义的正确的C代码。这个过程被称为解码或指令分派。
+#define INTERPRET_LOOP \
+    for (;;) \
+      switch (TRACE_EXECUTION(), READ_BYTE())
+#define CASE(name) case name:
+#define NEXT break
 #endif
-		uint8_t instruction = 0;
-		// 为了处理一条指令，我们首先需要弄清楚要处理的是哪种指令。READ_BYTE这个宏会读取ip当前指向字节，然后推进指令指针。
-		// 任何指令的第一个字节都是操作码。给定一个操作码，我们需要找到实现该指令语义的正确的C代码。这个过程被称为解码或指令分派。
-		switch (instruction = READ_BYTE()) {
-		case OP_CONSTANT: {
+
+	INTERPRET_LOOP {
+		CASE(OP_CONSTANT) {
 			// 你就知道产生一个值实际上意味着什么：将它压入栈。
 			Value constant = READ_CONSTANT();
 			push(constant);
-			break;
+			NEXT;
 		}
-		case OP_NIL:		push(NIL_VAL); break;
-		case OP_TRUE:		push(BOOL_VAL(true)); break;
-		case OP_FALSE:		push(BOOL_VAL(false)); break;
-		case OP_DEFINE_GLOBAL: {
-			// 我们从常量表中获取变量的名称，然后我们从栈顶获取值，并以该名称为键将其存储在哈希表中。
-			// 这段代码并没有检查键是否已经在表中。Lox对全局变量的处理非常宽松，允许你重新定义它们而且不会出错。
-			// 这在REPL会话中很有用，如果键恰好已经在哈希表中，虚拟机通过简单地覆盖值来支持这一点。
-			ObjString* name = READ_STRING();
-			tableSet(&vm.globals, name, peek(0));
+		CASE(OP_NIL)		push(NIL_VAL); NEXT;
+		CASE(OP_TRUE)		push(BOOL_VAL(true)); NEXT;
+		CASE(OP_FALSE)		push(BOOL_VAL(false)); NEXT;
+		CASE(OP_DEFINE_GLOBAL) {
+			// 我们从操作数中获取变量的槽号，然后从栈顶获取值，并将其存储在该槽中。
+			// 这段代码并没有检查变量是否已经定义。Lox对全局变量的处理非常宽松，允许你重新定义它们而且不会出错。
+			// 这在REPL会话中很有用，虚拟机通过简单地覆盖槽中的值来支持这一点。
+			uint16_t slot = READ_SHORT();
+			vm.globalValues.values[slot] = peek(0);
+			if (IS_YOUNG(peek(0))) rememberGlobal(slot);
 			pop();
-			break;
+			NEXT;
 		}
-		case OP_POP:		pop(); break;
-		case OP_GET_LOCAL: {
+		CASE(OP_POP)		pop(); NEXT;
+		CASE(OP_GET_LOCAL) {
 			// 它接受一个单字节操作数，用作局部变量所在的栈槽。它从索引处加载值，然后将其压入栈顶，在后面的指令可以找到它。
 			uint8_t slot = READ_BYTE();
 			push(vm.stack[slot]);
-			break;
+			NEXT;
 		}
-		case OP_SET_LOCAL: {
+		CASE(OP_SET_LOCAL) {
 			// 它从栈顶获取所赋的值，然后存储到与局部变量对应的栈槽中。注意，它不会从栈中弹出值。
 			// 请记住，赋值是一个表达式，而每个表达式都会产生一个值。赋值表达式的值就是所赋的值本身，所以虚拟机要把值留在栈上。
 			uint8_t slot = READ_BYTE();
 			vm.stack[slot] = peek(0);
-			break;
+			NEXT;
 		}
-		case OP_GET_GLOBAL: {
-			// 我们从指令操作数中提取常量表索引并获得变量名称。然后我们使用它作为键，在全局变量哈希表中查找变量的值。
-			ObjString* name = READ_STRING();
-			Value value;
-			// 如果该键不在哈希表中，就意味着这个全局变量从未被定义过。
+		CASE(OP_GET_GLOBAL) {
+			// 我们从指令操作数中提取槽号，然后直接从全局变量数组中读取变量的值。
+			uint16_t slot = READ_SHORT();
+			Value value = vm.globalValues.values[slot];
+			// 如果槽中还是“未定义”哨兵值，就意味着这个全局变量从未被定义过。
 			// 这在Lox中是运行时错误，所以如果发生这种情况，我们要报告错误并退出解释器循环。
-			if (!tableGet(&vm.globals, name, &value)) {
-				runtimeError("Undefined variable '%s'.", name->chars);
+			if (IS_UNDEFINED(value)) {
+				vm.ip = ip;
+				ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+				runtimeError("Undefined variable '%.*s'.", name->length, name->chars);
 				return INTERPRET_RUNTIME_ERROR;
 			}
 			// 否则，我们获取该值并将其压入栈中。
 			push(value);
-			break;
+			NEXT;
 		}
-		case OP_SET_GLOBAL: {
-			ObjString* name = READ_STRING();
-			// 主要的区别在于，当键在全局变量哈希表中不存在时会发生什么。
+		CASE(OP_SET_GLOBAL) {
+			uint16_t slot = READ_SHORT();
+			// 主要的区别在于，当变量还没有定义时会发生什么。
 			// 如果这个变量还没有定义，对其进行赋值就是一个运行时错误。Lox不做隐式的变量声明。
+			// 因为我们在写入之前先做检查，所以不需要像哈希表那样在出错时撤销写入。
 			// 另一个区别是，设置变量并不会从栈中弹出值。
 			// 记住，赋值是一个表达式，所以它需要把这个值保留在那里，以防赋值嵌套在某个更大的表达式中。
-			if (tableSet(&vm.globals, name, peek(0))) {
-				tableDelete(&vm.globals, name);
-				runtimeError("Undefined variable '%s'.", name->chars);
+			if (IS_UNDEFINED(vm.globalValues.values[slot])) {
+				vm.ip = ip;
+				ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+				runtimeError("Undefined variable '%.*s'.", name->length, name->chars);
 				return INTERPRET_RUNTIME_ERROR;
 			}
-			break;
+			vm.globalValues.values[slot] = peek(0);
+			if (IS_YOUNG(peek(0))) rememberGlobal(slot);
+			NEXT;
 		}
-		case OP_EQUAL: {
+		CASE(OP_EQUAL) {
 			Value b = pop();
 			Value a = pop();
 			// 你可以对任意一对对象执行==，即使这些对象是不同类型的。这有足够的复杂性，所以有必要把这个逻辑分流到一个单独的函数中。
 			// 这个函数会一个C语言的bool值，所以我们可以安全地把结果包装在一个BOLL_VAL中。这个函数与Value有关，所以它位于“value”模块中。
 			push(BOOL_VAL(valuesEqual(a, b)));
-			break;
+			NEXT;
 		}
-		case OP_GREATER:  BINARY_OP(BOOL_VAL, > ); break;
-		case OP_LESS:     BINARY_OP(BOOL_VAL, < ); break;
-		case OP_ADD: {	// 这四条指令之间唯一的区别是，它们最终使用哪一个底层C运算符来组合两个操作数。
+		CASE(OP_GREATER)  BINARY_OP(BOOL_VAL, > ); NEXT;
+		CASE(OP_LESS)     BINARY_OP(BOOL_VAL, < ); NEXT;
+		CASE(OP_ADD) {	// 这四条指令之间唯一的区别是，它们最终使用哪一个底层C运算符来组合两个操作数。
 			// 如果两个操作数都是字符串，则连接。如果都是数字，则相加。任何其它操作数类型的组合都是一个运行时错误。
-			if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+			if (IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))) {
 				concatenate();
 			}
 			else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
@@ -225,25 +436,27 @@ static InterpretResult run() {
 				push(NUMBER_VAL(a + b));
 			}
 			else {
+				vm.ip = ip;
 				runtimeError("Operands must be two numbers or two strings.");
 				return INTERPRET_RUNTIME_ERROR;
 			}
-			break;
+			NEXT;
 		}
-		case OP_SUBTRACT:	BINARY_OP(NUMBER_VAL, -); break;
-		case OP_MULTIPLY:	BINARY_OP(NUMBER_VAL, *); break;
-		case OP_DIVIDE:		BINARY_OP(NUMBER_VAL, / ); break;
-		case OP_NOT:		push(BOOL_VAL(isFalsey(pop()))); break;
-		case OP_NEGATE:		// 该指令需要操作一个值，该值通过弹出栈获得。它对该值取负，然后把结果重新压入栈，以便后面的指令使用。
+		CASE(OP_SUBTRACT)	BINARY_OP(NUMBER_VAL, -); NEXT;
+		CASE(OP_MULTIPLY)	BINARY_OP(NUMBER_VAL, *); NEXT;
+		CASE(OP_DIVIDE)		BINARY_OP(NUMBER_VAL, / ); NEXT;
+		CASE(OP_NOT)		push(BOOL_VAL(isFalsey(pop()))); NEXT;
+		CASE(OP_NEGATE)		// 该指令需要操作一个值，该值通过弹出栈获得。它对该值取负，然后把结果重新压入栈，以便后面的指令使用。
 			// 首先，我们检查栈顶的Value是否是一个数字。如果不是，则报告运行时错误并停止解释器。
 			if (!IS_NUMBER(peek(0))) {
+				vm.ip = ip;
 				runtimeError("Operand must be a number.");
 				return INTERPRET_RUNTIME_ERROR;
 			}
 			// 否则，我们就继续运行。只有在验证之后，我们才会拆装操作数，取负，将结果封装并压入栈。
 			push(NUMBER_VAL(-AS_NUMBER(pop())));
-			break;
-		case OP_PRINT: {	// 当解释器到达这条指令时，它已经执行了表达式的代码，将结果值留在了栈顶。现在我们只需要弹出该值并打印。
+			NEXT;
+		CASE(OP_PRINT) {	// 当解释器到达这条指令时，它已经执行了表达式的代码，将结果值留在了栈顶。现在我们只需要弹出该值并打印。
 			// 请注意，在此之后我们不会再向栈中压入任何内容。
 			// 这是虚拟机中表达式和语句之间的一个关键区别。每个字节码指令都有堆栈效应，这个值用于描述指令如何修改堆栈内容。
 			// 你可以把一系列指令的堆栈效应相加，得到它们的总体效应。
@@ -252,15 +465,15 @@ static InterpretResult run() {
 			// 这一点很重要，因为等我们涉及到控制流和循环时，一个程序可能会执行一长串的语句。如果每条语句都增加或减少堆栈，最终就可能会溢出或下溢。
 			printValue(pop());
 			printf("\n");
-			break;
+			NEXT;
 		}
-		case OP_JUMP: {
+		CASE(OP_JUMP) {
 			// 这里没有什么特别出人意料的——唯一的区别就是它不检查条件，并且一定会应用偏移量。
 			uint16_t offset = READ_SHORT();
-			vm.ip += offset;
-			break;
+			ip += offset;
+			NEXT;
 		}
-		case OP_JUMP_IF_FALSE: {	
+		CASE(OP_JUMP_IF_FALSE) {	
 			// 这是我们添加的第一个需要16位操作数的指令。为了从字节码块中读出这个指令，需要使用一个新的宏。
 			uint16_t offset = READ_SHORT();
 			// 读取偏移量之后，我们检查栈顶的条件值。如果是假，我们就将这个跳转偏移量应用到ip上。
@@ -268,19 +481,78 @@ static InterpretResult run() {
 			// 在条件为假的情况下，我们不需要做任何其它工作。
 			// 我们已经移动了ip，所以当外部指令调度循环再次启动时，将会在新指令处执行，跳过了then分支的所有代码。
 			// 请注意，跳转指令并没有将条件值弹出栈。因此，我们在这里还没有全部完成，因为还在堆栈上留下了一个额外的值。我们很快就会把它清理掉。
-			if (isFalsey(peek(0))) vm.ip += offset;
-			break;
+			if (isFalsey(peek(0))) ip += offset;
+			NEXT;
 		}
-		case OP_LOOP: {
+		CASE(OP_LOOP) {
 			// 与OP_JUMP唯一的区别就是这里使用了减法而不是加法。
 			uint16_t offset = READ_SHORT();
-			vm.ip -= offset;
-			break;
+			ip -= offset;
+			NEXT;
 		}
-		case OP_RETURN: {
-			return INTERPRET_OK;
+		// 下面是窥孔优化生成的超级指令。每一条都与它所替换的指令序列有完全相同的栈效应和错误信息，只是少了几次分派。
+		CASE(OP_ADD_LOCALS) {
+			// 两个操作数直接从局部变量的栈槽中读取，不需要先压入栈再弹出。
+			Value a = vm.stack[READ_BYTE()];
+			Value b = vm.stack[READ_BYTE()];
+			if (IS_NUMBER(a) && IS_NUMBER(b)) {
+				push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+			}
+			else if (IS_ANY_STRING(a) && IS_ANY_STRING(b)) {
+				// 字符串连接很少出现在热循环里，所以我们直接复用concatenate()，它期望两个操作数都在栈上。
+				push(a);
+				push(b);
+				concatenate();
+			}
+			else {
+				vm.ip = ip;
+				runtimeError("Operands must be two numbers or two strings.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			NEXT;
 		}
+		CASE(OP_LESS_JUMP_IF_FALSE) {
+			uint16_t offset = READ_SHORT();
+			if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+				vm.ip = ip;
+				runtimeError("Operands must be numbers.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			double b = AS_NUMBER(pop());
+			double a = AS_NUMBER(pop());
+			// 原来的序列在条件为真时会压入true然后立即弹出，所以这里什么也不用做。
+			// 条件为假时，OP_JUMP_IF_FALSE会把false留在栈上再跳转，跳转目标处的代码（通常是一条OP_POP）期望它在那里。
+			if (!(a < b)) {
+				push(BOOL_VAL(false));
+				ip += offset;
+			}
+			NEXT;
 		}
+		CASE(OP_ADD_CONSTANT) {
+			Value b = READ_CONSTANT();
+			Value a = peek(0);
+			if (IS_NUMBER(a) && IS_NUMBER(b)) {
+				vm.stackTop[-1] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+			}
+			else if (IS_ANY_STRING(a) && IS_ANY_STRING(b)) {
+				push(b);
+				concatenate();
+			}
+			else {
+				vm.ip = ip;
+				runtimeError("Operands must be two numbers or two strings.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			NEXT;
+		}
+		CASE(OP_RETURN) {
+			vm.ip = ip;
+			return INTERPRET_OK;
+		}
+#ifdef COMPUTED_GOTO
+		op_UNKNOWN:
+			NEXT;
+#endif
 	}
 
 #undef READ_BYTE
@@ -288,6 +560,62 @@ static InterpretResult run() {
 #undef READ_CONSTANT
 #undef READ_STRING
 #undef BINARY_OP
+#undef TRACE_EXECUTION
+#undef DISPATCH
+#undef INTERPRET_LOOP
+#undef CASE
+#undef NEXT
+}
+
+// 每种标志组合对应run()的一份实例，按标志的值索引。
+template <int... Flags>
+static constexpr std::array<InterpretResult(*)(), sizeof...(Flags)> makeRuns(std::integer_sequence<int, Flags...>) {
+	return { run<Flags>... };
+}
+
+static constexpr auto runs = makeRuns(std::make_integer_sequence<int, RUN_FLAG_COMBINATIONS>());
+
+InterpretResult interpretChunk(Chunk* chunk) {
+	vm.chunk = chunk;
+	vm.ip = vm.chunk->code;
+	// 编译器把栈槽0留给虚拟机自己使用，局部变量从槽1开始。每次执行都从一个空栈开始，在槽0中放一个nil，这样局部变量的槽号才正好是它在栈中的位置。
+	resetStack();
+	push(NIL_VAL);
+
+	// 编译出来的块已经由编译器打印过了，从.salc文件载入的块没有经过编译器，所以在这里打印。
+	// 反汇编时驻留的字符串常量写回了常量表，而块已经是虚拟机的当前块，所以它们不会被回收。
+	if (vm.printCode && chunk->image != NULL) disassembleChunk(chunk, "<script>");
+
+	int flags = (vm.traceExecution ? RUN_TRACE : 0) | (vm.printStats ? RUN_COUNT : 0) | (vm.profile ? RUN_PROFILE : 0) |
+		(vm.sampling ? RUN_SAMPLE : 0);
+	if (vm.profile) startProfile();
+	if (vm.sampling) beginSampling(chunk);
+	InterpretResult result = runs[flags]();
+	if (vm.sampling) {
+		vm.sampledIp = NULL;
+		endSampling(chunk);
+	}
+	// 调用者随后会释放这个块，所以之后的垃圾回收不能再把它的常量表当作根。
+	vm.chunk = NULL;
+	return result;
+}
+
+InterpretResult compileToFile(const char* source, const char* path) {
+	Chunk chunk;
+	initChunk(&chunk);
+
+	if (!compile(source, &chunk)) {
+		freeChunk(&chunk);
+		return INTERPRET_COMPILE_ERROR;
+	}
+
+	// 写入失败时writeBytecodeFile()已经报告了错误。
+	// 写入时分配缓冲区可能会触发垃圾回收，块中的字符串常量必须保持可达，所以在写入期间我们把它当作虚拟机的当前块。
+	vm.chunk = &chunk;
+	bool written = writeBytecodeFile(&chunk, path);
+	vm.chunk = NULL;
+	freeChunk(&chunk);
+	return written ? INTERPRET_OK : INTERPRET_RUNTIME_ERROR;
 }
 
 InterpretResult interpret(const char* source) {
@@ -303,10 +631,7 @@ InterpretResult interpret(const char* source) {
 	}
 
 	// 否则，我们将完整的字节码块发送到虚拟机中去执行。
-	vm.chunk = &chunk;
-	vm.ip = vm.chunk->code;
-
-	InterpretResult result = run();
+	InterpretResult result = interpretChunk(&chunk);
 
 	// 当虚拟机完成后，我们会释放该字节码块，这样就完成了。
 	freeChunk(&chunk);
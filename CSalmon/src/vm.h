@@ -8,6 +8,23 @@
 // 给我们的虚拟机一个固定的栈大小，意味着某些指令系列可能会压入太多的值并耗尽栈空间——典型的“堆栈溢出”。
 #define STACK_MAX 256
 
+// 一块交给虚拟机保管的源代码（见retainSource()）。
+typedef struct {
+	char* chars;
+	size_t length;
+} RetainedSource;
+
+// 写屏障的记录（见rememberSlot()和rememberEntry()）。
+typedef struct {
+	ValueArray* array;
+	int index;
+} RememberedSlot;
+
+typedef struct {
+	Table* table;
+	ObjString* key;
+} RememberedEntry;
+
 // 虚拟机是我们解释器内部结构的一部分。你把一个代码块交给它，它就会运行这块代码。VM的代码和数据结构放在一个新的模块中。
 typedef struct {
 	Chunk* chunk;
@@ -21,7 +38,13 @@ typedef struct {
 	Value stack[STACK_MAX];
 	Value* stackTop;
 	// 我们需要一个地方来存储这些全局变量。因为我们希望它们在clox运行期间一直存在，所以我们将它们之间存储在虚拟机中。
+	// 编译器为每个全局变量名分配一个固定的槽号，globals把名称映射到槽号，globalValues按槽号保存变量的值。
+	// 运行时只需要用指令中的槽号索引globalValues，不再按名称查找哈希表。globalNames按槽号保存变量名，仅用于报告错误。
 	Table globals;
+	ValueArray globalValues;
+	ValueArray globalNames;
+	// 嵌入虚拟机的C代码（例如微基准测试）自己持有的值。回收器把它们当作根，这样这些值不需要借用脚本可见的全局变量表来存活。
+	ValueArray hostRoots;
 	// 我们将使用一种叫作字符串驻留的技术，核心问题是，在内存中不同的字符串可能包含相同的字符。
 	// 尽管它们是不同的对象，它们的行为也需要像等效值一样。它们本质上是相同的，而我们必须比较它们所有的字节来检查这一点。
 	// 字符串驻留是一个数据去重的过程。
@@ -34,6 +57,58 @@ typedef struct {
 	Table strings;
 	// VM存储一个指向表头的指针。
 	Obj* objects;
+	// 垃圾回收器的状态。bytesAllocated是通过reallocate()分配的、仍然存活的字节数，一旦超过nextGC就进行一次回收。
+	// stressGC让每次分配都触发一次回收，用来尽早暴露没有被正确标记的根。
+	size_t bytesAllocated;
+	size_t nextGC;
+	// reallocate()按分类统计的内存使用，以及bytesAllocated曾经达到的最大值。printMemoryStats在--mem-stats时打开，freeVM()会在释放任何东西之前打印报告。
+	MemoryStats memory[MEM_CATEGORY_COUNT];
+	size_t peakBytesAllocated;
+	bool printMemoryStats;
+	bool stressGC;
+	// 灰色对象：已经被标记、但它引用的对象还没有被追踪的对象。这个栈本身用系统的realloc()管理，这样扩展它不会递归地触发回收。
+	int grayCount;
+	int grayCapacity;
+	Obj** grayStack;
+	// 新生代是一块连续的内存，年轻对象在其中从nurseryStart向nurseryEnd依次分配。nurseryFull表示有分配因为放不下而去了老年代，下一个安全点应当进行次要回收。
+	char* nurseryStart;
+	char* nurseryTop;
+	char* nurseryEnd;
+	bool nurseryFull;
+	RememberedSlot* rememberedSlots;
+	int rememberedSlotCount;
+	int rememberedSlotCapacity;
+	RememberedEntry* rememberedEntries;
+	int rememberedEntryCount;
+	int rememberedEntryCapacity;
+	int minorCollections;
+	int majorCollections;
+	// 交给虚拟机保管的源代码。借用它们的字符串可能一直存活到虚拟机关闭，所以它们要保留到freeVM()。
+	RetainedSource* sources;
+	int sourceCount;
+	int sourceCapacity;
+	// 调试输出由命令行标志在运行时打开，而不是在构建时用宏硬编码。
+	// traceExecution选择带追踪的那份解释器循环实例，printCode让编译器在每次编译后反汇编字节码块。
+	bool traceExecution;
+	bool printCode;
+	// peephole控制编译器是否在每个字节码块上运行窥孔优化。
+	bool peephole;
+	// 当用户传入--stats时，解释器循环会统计执行过的分派次数，并在退出时打印一份报告。
+	bool printStats;
+	uint64_t dispatchCount;
+	// 当用户传入--profile时，虚拟机使用解释器循环的分析实例，并在退出时打印每个操作码的执行次数和耗时，以及最常见的操作码对。
+	bool profile;
+	// sampling在--sample-profile时打开，虚拟机使用解释器循环的抽样实例，它在分派每条指令之前把指令指针写入sampledIp，供SIGPROF的处理程序读取。
+	// 信号可能在任何两条机器指令之间到达，所以sampledIp必须是volatile的，编译器不能把对它的写入推迟或合并。
+	bool sampling;
+	const uint8_t* volatile sampledIp;
+	// 编译器在每次编译结束时累加生成的字节码大小和行号表所占的内存，供--stats报告。
+	size_t codeBytes;
+	size_t lineTableBytes;
+	// 编译缓存的命中、未命中和淘汰次数。
+	int cacheHits;
+	int cacheMisses;
+	int cacheEvictions;
 } VM;
 
 // 当我们有一个报告静态错误的编译器和检测运行时错误的VM时，解释器会通过它来知道如何设置进程的退出代码。
@@ -46,12 +121,31 @@ typedef enum {
 // “object”模块直接使用了“vm”模块的vm变量，所以我们需要将该变量公开到外部。
 extern VM vm;
 
+// 对象是否在新生代中。写屏障在每次存储时都要检查它，所以它只是两次指针比较。
+static inline bool isYoungObject(Obj* object) {
+	return (char*)object >= vm.nurseryStart && (char*)object < vm.nurseryEnd;
+}
+
+#define IS_YOUNG(value) (IS_OBJ(value) && isYoungObject(AS_OBJ(value)))
+
 // VM会逐步获取到一大堆它需要跟踪的状态，所以我们现在定义一个结构，把这些状态都塞进去。
 void initVM();
 void freeVM();
 // 我们已经得到了Lox源代码字符串，所以现在我们准备建立一个管道来扫描、编译和执行它。管道是由interpret()驱动的。
 InterpretResult interpret(const char* source);
 
+// 只编译source而不执行它，把得到的字节码写入path指向的.salc文件。文件写入失败时返回INTERPRET_RUNTIME_ERROR。
+InterpretResult compileToFile(const char* source, const char* path);
+// 执行一个已经编译好的字节码块，例如从.salc文件载入的块。
+InterpretResult interpretChunk(Chunk* chunk);
+// 把source（必须由malloc()分配）的所有权交给虚拟机，它会在freeVM()中被释放。
+// 编译保管的源代码时，字符串字面量和变量名直接借用其中的字节，而不是把它们复制到新的字符串中。
+void retainSource(char* source);
+// chars是否指向某一块保管的源代码。
+bool isRetainedSource(const char* chars);
+// 返回全局变量name的槽号。如果这个名字还没有槽，就分配一个新的，初始化为“未定义”哨兵值。槽已经用完时返回-1。
+int declareGlobal(ObjString* name);
+
 void push(Value value);
 Value pop();
 
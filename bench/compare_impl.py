@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+# 用JSalmon（Java的树遍历解释器）和CSalmon（C++的字节码虚拟机）运行同一组脚本，检查两者的输出是否逐字节相同，并记录每个脚本的速度比。
+# 用法：
+#   python3 bench/compare_impl.py path/to/CSalmon [-n 3] [--java java] [--classes dir] [--timeout 120] [--exact] [-o result.json] [脚本或目录 ...]
+# 没有给出脚本时使用bench/*.salmon；给出目录时使用其中所有的.salmon文件。
+# 没有给出--classes时，先用javac把JSalmon/src/salmon编译到一个临时目录中，然后用java -cp运行salmon.Salmon。
+# 对每个脚本，两个实现的标准输出和退出码都必须相同；标准错误不做比较，因为两者的错误信息格式本来就不同。
+# 两个实现打印数字的格式不同：JSalmon使用Java的Double.toString()（例如1.0E14、0.30000000000000004），CSalmon使用printf的%g（1e+14、0.3）。
+# 所以默认情况下，比较之前把输出中的每个数字都按%g重新格式化（6位有效数字，无穷大和NaN统一写作inf和nan）。
+# 结果中的identical表示输出逐字节相同，equivalent表示重新格式化之后相同，normalized_lines是只有在重新格式化之后才相同的行数。
+# 注意这种比较也会把字符串中的数字重新格式化，所以字符串中只有数字格式不同的差别会被忽略。--exact关闭重新格式化，要求输出逐字节相同。
+# 每个实现运行N次，取墙钟时间的中位数，速度比是JSalmon的时间除以CSalmon的时间。JVM的启动时间也计算在内，所以很短的脚本的速度比没有多少意义。
+# 结果以JSON格式写出，任何一个脚本的输出或退出码不一致时，以非0的退出码结束。
+import argparse
+import glob
+import json
+import math
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+JSALMON_SOURCES = os.path.join(os.path.dirname(BENCH_DIR), "JSalmon", "src", "salmon")
+
+# 两个实现可能打印出的数字：整数、小数、科学计数法，以及Java和C各自写法的无穷大和NaN。标识符中的数字（例如value_12）不算。
+NUMBER = re.compile(rb"(?<![\w.])-?(?:Infinity|inf|NaN|nan|\d+(?:\.\d*)?(?:[eE][+-]?\d+)?)(?![\w.])")
+
+def format_number(match):
+    value = float(match.group(0))
+    # C库可能把NaN打印成-nan，符号没有意义。
+    return b"nan" if math.isnan(value) else b"%g" % value
+
+def normalize(line):
+    return NUMBER.sub(format_number, line)
+
+def compile_jsalmon(javac, output):
+    sources = sorted(glob.glob(os.path.join(JSALMON_SOURCES, "*.java")))
+    try:
+        subprocess.run([javac, "-encoding", "UTF-8", "-d", output] + sources, check=True)
+    except (OSError, subprocess.CalledProcessError) as error:
+        sys.exit("cannot compile JSalmon: %s" % error)
+
+def collect_scripts(paths):
+    if not paths:
+        paths = [BENCH_DIR]
+    scripts = []
+    for path in paths:
+        if os.path.isdir(path):
+            scripts.extend(sorted(glob.glob(os.path.join(path, "*.salmon"))))
+        else:
+            scripts.append(path)
+    return scripts
+
+def run_once(command, timeout):
+    start = time.perf_counter()
+    try:
+        completed = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, timeout=timeout)
+    except subprocess.TimeoutExpired:
+        return None, None, time.perf_counter() - start
+    return completed.stdout, completed.returncode, time.perf_counter() - start
+
+# 运行N次，每次的输出都必须相同，否则说明实现本身是不确定的，这同样要报告出来。
+def measure(command, runs, timeout):
+    outputs = set()
+    codes = set()
+    times = []
+    for _ in range(runs):
+        output, code, elapsed = run_once(command, timeout)
+        if output is None:
+            return {"timed_out": True}, None
+        outputs.add(output)
+        codes.add(code)
+        times.append(elapsed)
+    deterministic = len(outputs) == 1 and len(codes) == 1
+    result = {
+        "timed_out": False,
+        "exit_code": codes.pop() if len(codes) == 1 else sorted(codes),
+        "deterministic": deterministic,
+        "median_seconds": statistics.median(times),
+        "min_seconds": min(times),
+    }
+    return result, outputs.pop() if deterministic else None
+
+# 逐行比较两份输出。返回（只有在重新格式化数字之后才相同的行数，第一处不同的行）；exact为真时不重新格式化。
+# 第一处不同的行用来快速定位语义上的差别，两份输出等价时它是None。
+def compare_lines(expected, actual, exact):
+    expected_lines = expected.split(b"\n")
+    actual_lines = actual.split(b"\n")
+    normalized = 0
+    for i in range(max(len(expected_lines), len(actual_lines))):
+        left = expected_lines[i] if i < len(expected_lines) else None
+        right = actual_lines[i] if i < len(actual_lines) else None
+        if left == right:
+            continue
+        if not exact and left is not None and right is not None and normalize(left) == normalize(right):
+            normalized += 1
+            continue
+        decode = lambda line: None if line is None else line.decode("utf-8", "replace")
+        return normalized, {"line": i + 1, "jsalmon": decode(left), "csalmon": decode(right)}
+    return normalized, None
+
+def main():
+    parser = argparse.ArgumentParser(description="比较JSalmon和CSalmon的输出和速度。")
+    parser.add_argument("binary", help="CSalmon可执行文件的路径")
+    parser.add_argument("scripts", nargs="*", help="要运行的脚本或目录，默认是bench目录")
+    parser.add_argument("-n", "--runs", type=int, default=3, help="每个实现运行每个脚本的次数")
+    parser.add_argument("--java", default="java", help="java可执行文件")
+    parser.add_argument("--javac", default="javac", help="javac可执行文件，只在没有给出--classes时使用")
+    parser.add_argument("--classes", help="已经编译好的JSalmon类文件目录")
+    parser.add_argument("--timeout", type=float, default=120, help="每次运行的超时秒数")
+    parser.add_argument("--exact", action="store_true", help="要求输出逐字节相同，不重新格式化数字")
+    parser.add_argument("-o", "--output", help="把JSON写入这个文件，而不是标准输出")
+    args = parser.parse_intermixed_args()
+    if args.runs < 1:
+        parser.error("-n must be at least 1")
+
+    binary = os.path.abspath(args.binary)
+    scripts = collect_scripts(args.scripts)
+    work = None
+    classes = args.classes
+    results = []
+    try:
+        if classes is None:
+            work = tempfile.mkdtemp(prefix="jsalmon-")
+            classes = work
+            compile_jsalmon(args.javac, classes)
+
+        for script in scripts:
+            name = os.path.basename(script)
+            java, java_output = measure([args.java, "-cp", classes, "salmon.Salmon", script], args.runs, args.timeout)
+            native, native_output = measure([binary, script], args.runs, args.timeout)
+            comparable = java_output is not None and native_output is not None and java.get("exit_code") == native.get("exit_code")
+            identical = comparable and java_output == native_output
+            result = {"script": script, "identical": identical, "equivalent": identical, "normalized_lines": 0, "jsalmon": java, "csalmon": native}
+            if java_output is not None and native_output is not None and not identical:
+                normalized, difference = compare_lines(java_output, native_output, args.exact)
+                result["equivalent"] = comparable and difference is None
+                result["normalized_lines"] = normalized
+                if difference is not None:
+                    result["first_difference"] = difference
+            if not java["timed_out"] and not native["timed_out"] and native["median_seconds"] > 0:
+                result["speedup"] = java["median_seconds"] / native["median_seconds"]
+            results.append(result)
+            speedup = "%.1fx" % result["speedup"] if "speedup" in result else "-"
+            verdict = "identical" if identical else "equivalent" if result["equivalent"] else "DIFFERENT"
+            print("%-24s %-10s speedup %s" % (name, verdict, speedup), file=sys.stderr)
+    finally:
+        if work is not None:
+            shutil.rmtree(work, ignore_errors=True)
+
+    report = {
+        "binary": binary,
+        "java": args.java,
+        "runs": args.runs,
+        "number_normalization": None if args.exact else "%g",
+        "scripts": results,
+    }
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as out:
+            out.write(text + "\n")
+    else:
+        print(text)
+
+    if not all(result["equivalent"] for result in results):
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
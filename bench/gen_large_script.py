@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# 生成一个很大的Salmon脚本，用来衡量编译器生成的字节码和行号表的大小。
+# 用法：
+#   python3 bench/gen_large_script.py 100000 > /tmp/large.salmon
+#   CSalmon --stats /tmp/large.salmon
+# --stats会同时给出游程编码的行号表大小，以及为每个字节存储一个int行号时需要的内存。
+# 生成的代码由大量的全局变量赋值、算术表达式和条件语句组成，其中一些表达式跨越多行。
+# 一个字节码块最多只能有256个常量，所以所有的数字都事先放在几个全局变量里，循环生成的语句中不再出现字面量。
+import sys
+
+def main():
+    statements = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+    out = sys.stdout
+    out.write("var total = 0;\n")
+    out.write("var a = 1;\n")
+    out.write("var b = 2;\n")
+    out.write("var one = 1;\n")
+    out.write("var limit = 1000;\n")
+    for i in range(statements):
+        kind = i % 4
+        if kind == 0:
+            out.write("total = total + a * b - one;\n")
+        elif kind == 1:
+            out.write("if (total > limit) total = total - limit;\n")
+        elif kind == 2:
+            out.write("a = a + one;\nb = b +\n  a;\n")
+        else:
+            out.write("if (a < b) total = total + one; else total = total - one;\n")
+    out.write("print total;\n")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+# 生成一个很大的Salmon脚本，用来衡量扫描器的吞吐量（MB/s）。
+# 用法：
+#   python3 bench/gen_scanner_input.py 200000 > /tmp/scan.salmon
+#   CSalmon --bench-scanner /tmp/scan.salmon
+# --bench-scanner只扫描不编译，它会反复扫描整个文件至少一秒钟，然后报告吞吐量以及所有词法标识的校验和。
+# 用定义了SCALAR_SCANNER的构建运行同一个文件，校验和应当完全相同，吞吐量则可以用来比较SIMD扫描和逐字节扫描。
+# 生成的代码模仿机器生成的脚本：深层缩进、很长的标识符和数字、行尾注释，以及一些跨越多行的长字符串。
+import sys
+
+def main():
+    statements = int(sys.argv[1]) if len(sys.argv) > 1 else 200000
+    out = sys.stdout
+    out.write("// 由gen_scanner_input.py生成。\n")
+    for i in range(statements):
+        indent = "    " * (1 + i % 6)
+        kind = i % 5
+        if kind == 0:
+            out.write(f"{indent}var generated_accumulator_value_{i} = 1234567890.0987654321 * {i};\n")
+        elif kind == 1:
+            out.write(f"{indent}// 第{i}条语句：这是一段比较长的注释，扫描器应当整段跳过它，直到行尾的换行符为止。\n")
+        elif kind == 2:
+            out.write(f"{indent}print \"message number {i}: the quick brown fox jumps over the lazy dog\";\n")
+        elif kind == 3:
+            out.write(f"{indent}generated_accumulator_value_{i - 3} = generated_accumulator_value_{i - 3} + 1; // 累加\n")
+        else:
+            out.write(f"{indent}print \"a string literal that spans\n{indent}several lines of source text\n{indent}and ends here {i}\";\n")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,390 @@
+// CSalmon内部数据结构的微基准测试。它直接链接CSalmon的源文件，只通过公开的接口（table.h、scanner.h、compiler.h和object.h）操作，
+// 所以同一份代码可以和任何版本的实现一起编译，用来单独比较某个数据结构的改动，而不受整个脚本运行时其它部分的干扰。
+// 用法（在仓库根目录）：
+//   g++ -std=c++20 -O2 -I CSalmon/src bench/micro_bench.cpp $(ls CSalmon/src/*.cpp | grep -v main.cpp) -o micro_bench
+//   ./micro_bench [名称]
+// 给出名称时只运行名称中包含它的测试，例如“table”、“@0.75”或“scan”。结果以JSON格式写到标准输出，每个测试报告每次操作的平均耗时（纳秒）和操作次数：
+//   table_insert            从空表开始插入所有的键（包括扩容），然后释放整张表，反复进行。
+//   table_get_hit/miss      在不同负载因子的表中查找在表中和不在表中的键。负载因子是（count + tombstones）与容量的比值。
+//   table_set_existing      给表中已有的键赋新值。
+//   table_delete_insert     删除一个键再把它插回去，每次计为两个操作。删除留下的墓碑会被插入重用，所以负载因子保持不变。
+//   table_find_string_hit/miss  用tableFindString()按字符、长度和哈希值查找，就像字符串驻留那样。
+//                           以上的表测试在每个负载因子下各运行一次，名称后面附上目标负载因子，例如table_get_hit@0.75，实际的负载因子在load_factor字段中。
+//   scan_*                  用scanToken()扫描几种在内存中生成的源代码，另外报告MB/s和每秒的词法标识数。
+//   compile                 编译一个生成的脚本，另外报告每秒编译的行数和MB/s。
+//   intern_copy_hit/miss    用copyString()驻留已经存在和还不存在的字符串。
+//   intern_borrow_miss      用borrowString()驻留还不存在的字符串，它不复制字符。
+// 计时使用clock()，也就是进程的CPU时间。
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "scanner.h"
+#include "table.h"
+#include "vm.h"
+
+// 把值放进vm.hostRoots，让它在垃圾回收中存活。扩展数组时可能触发回收，所以先把值暂时压入栈中。
+static void retainValue(Value value) {
+	push(value);
+	writeValueArray(&vm.hostRoots, value, MEM_OTHER);
+	pop();
+}
+
+// 每个测试至少运行这么长时间，以得到稳定的计时。
+#define MIN_SECONDS 0.5
+
+// 负载因子测试使用的表容量。表只在负载超过7/8时扩容到两倍，所以count在容量的7/16到7/8之间时，容量正好是这个值。
+#define TABLE_CAPACITY (1 << 17)
+
+// 驻留未命中的测试每一批驻留这么多个新字符串，然后（不计时）回收它们，下一批就又都是新字符串了。
+#define INTERN_BATCH 10000
+
+static const char* filter = "";
+static bool firstResult = true;
+
+static double seconds(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static bool selected(const char* name) {
+	return strstr(name, filter) != NULL;
+}
+
+// 每个结果是一个JSON对象。beginResult()写出名称和每次操作的耗时，调用者可以再用addField()添加其它数值，最后用endResult()结束这个对象。
+static void beginResult(const char* name, double elapsed, long long operations) {
+	printf("%s\n    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"operations\": %lld",
+		firstResult ? "" : ",", name, elapsed * 1e9 / (double)operations, operations);
+	firstResult = false;
+}
+
+static void addField(const char* key, double value) {
+	printf(", \"%s\": %.3f", key, value);
+}
+
+static void endResult() {
+	printf("}");
+}
+
+static void report(const char* name, double elapsed, long long operations) {
+	beginResult(name, elapsed, operations);
+	endResult();
+}
+
+static double loadFactor(Table* table) {
+	return (double)(table->count + table->tombstones) / table->capacity;
+}
+
+// ------------------哈希表------------------
+
+static void benchInsert(ObjString** keys, int count) {
+	long long operations = 0;
+	clock_t start = clock();
+	do {
+		Table table;
+		initTable(&table);
+		for (int i = 0; i < count; i++) tableSet(&table, keys[i], NUMBER_VAL((double)i));
+		freeTable(&table);
+		operations += count;
+	} while (seconds(start) < MIN_SECONDS);
+	report("table_insert", seconds(start), operations);
+}
+
+// 负载因子测试的名称带有请求的负载因子，例如table_get_hit@0.75，这样不同负载因子的结果可以按名称区分和筛选。返回的字符串在下一次调用之前有效。
+static const char* loadName(const char* name, double target) {
+	static char fullName[64];
+	snprintf(fullName, sizeof(fullName), "%s@%.2f", name, target);
+	return fullName;
+}
+
+static void reportLoad(const char* name, double elapsed, long long operations, double load) {
+	beginResult(name, elapsed, operations);
+	addField("load_factor", load);
+	endResult();
+}
+
+// keys的前count个在表中，其余的不在，所以查找keys[count]之后的键总是不命中。
+static void benchLoad(ObjString** keys, int keyCount, int count, double target) {
+	Table table;
+	initTable(&table);
+	for (int i = 0; i < count; i++) tableSet(&table, keys[i], NUMBER_VAL((double)i));
+	double load = loadFactor(&table);
+	int misses = keyCount - count;
+	int found = 0;
+	Value value;
+
+	if (selected(loadName("table_get_hit", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < count; i++) found += tableGet(&table, keys[i], &value);
+			operations += count;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_get_hit", target), seconds(start), operations, load);
+	}
+
+	if (selected(loadName("table_get_miss", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < misses; i++) found += tableGet(&table, keys[count + i], &value);
+			operations += misses;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_get_miss", target), seconds(start), operations, load);
+	}
+
+	if (selected(loadName("table_set_existing", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < count; i++) tableSet(&table, keys[i], NUMBER_VAL((double)operations));
+			operations += count;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_set_existing", target), seconds(start), operations, load);
+	}
+
+	if (selected(loadName("table_delete_insert", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < count; i++) {
+				tableDelete(&table, keys[i]);
+				tableSet(&table, keys[i], NUMBER_VAL((double)i));
+			}
+			operations += count * 2;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_delete_insert", target), seconds(start), operations, loadFactor(&table));
+	}
+
+	if (selected(loadName("table_find_string_hit", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < count; i++) {
+				found += tableFindString(&table, keys[i]->chars, keys[i]->length, keys[i]->hash) != NULL;
+			}
+			operations += count;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_find_string_hit", target), seconds(start), operations, load);
+	}
+
+	if (selected(loadName("table_find_string_miss", target))) {
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < misses; i++) {
+				ObjString* key = keys[count + i];
+				found += tableFindString(&table, key->chars, key->length, key->hash) != NULL;
+			}
+			operations += misses;
+		} while (seconds(start) < MIN_SECONDS);
+		reportLoad(loadName("table_find_string_miss", target), seconds(start), operations, load);
+	}
+
+	// 用一下结果，免得编译器把查找优化掉。
+	if (found < 0) fprintf(stderr, "impossible\n");
+	freeTable(&table);
+}
+
+static void benchTables() {
+	// 键是驻留的字符串，就像虚拟机中的变量名一样。
+	// 这些字符串不被任何脚本引用，为了让它们在垃圾回收中存活，我们把它们放进vm.hostRoots。
+	int keyCount = TABLE_CAPACITY;
+	ObjString** keys = (ObjString**)malloc(sizeof(ObjString*) * keyCount);
+	for (int i = 0; i < keyCount; i++) {
+		char name[32];
+		int length = snprintf(name, sizeof(name), "bench key %d", i);
+		keys[i] = copyString(name, length);
+		retainValue(OBJ_VAL(keys[i]));
+	}
+
+	if (selected("table_insert")) benchInsert(keys, keyCount / 2);
+
+	static const double loads[] = { 0.45, 0.6, 0.75, 0.85 };
+	for (int i = 0; i < (int)(sizeof(loads) / sizeof(loads[0])); i++) {
+		benchLoad(keys, keyCount, (int)(loads[i] * TABLE_CAPACITY), loads[i]);
+	}
+
+	vm.hostRoots.count = 0;
+	free(keys);
+}
+
+// ------------------扫描器和编译器------------------
+
+typedef struct {
+	char* chars;
+	int length;
+	int capacity;
+} Source;
+
+static void append(Source* source, const char* format, ...) {
+	char line[256];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (source->length + length + 1 > source->capacity) {
+		source->capacity = (source->length + length + 1) * 2;
+		source->chars = (char*)realloc(source->chars, source->capacity);
+	}
+	memcpy(source->chars + source->length, line, length + 1);
+	source->length += length;
+}
+
+// 普通的代码：关键字、标识符、数字和运算符，几乎没有注释和字符串。
+static Source codeSource(int statements) {
+	Source source = { NULL, 0, 0 };
+	for (int i = 0; i < statements; i++) {
+		switch (i % 4) {
+			case 0: append(&source, "var value_%d = first * (second + 12.5) - third / 4;\n", i); break;
+			case 1: append(&source, "if (value_%d >= limit and flag != nil) total = total + 1;\n", i - 1); break;
+			case 2: append(&source, "while (counter < 10) { counter = counter + 1; }\n"); break;
+			default: append(&source, "print !(left == right) or value_%d <= 3;\n", i - 3); break;
+		}
+	}
+	return source;
+}
+
+// 以注释为主的代码，扫描器大部分时间在跳过注释。
+static Source commentSource(int statements) {
+	Source source = { NULL, 0, 0 };
+	for (int i = 0; i < statements; i++) {
+		append(&source, "        // statement %d: a fairly long comment that the scanner skips up to the end of the line\n", i);
+		if (i % 4 == 0) append(&source, "        total = total + %d;\n", i);
+	}
+	return source;
+}
+
+// 以长字符串字面量为主的代码，其中一些跨越多行。
+static Source stringSource(int statements) {
+	Source source = { NULL, 0, 0 };
+	for (int i = 0; i < statements; i++) {
+		if (i % 2 == 0) {
+			append(&source, "print \"message number %d: the quick brown fox jumps over the lazy dog\";\n", i);
+		}
+		else {
+			append(&source, "print \"a string literal that spans\nseveral lines of source text\nand ends here %d\";\n", i);
+		}
+	}
+	return source;
+}
+
+static void benchScan(const char* name, Source source) {
+	long long tokens = 0;
+	long long passes = 0;
+	clock_t start = clock();
+	do {
+		initScanner(source.chars);
+		for (;;) {
+			Token token = scanToken();
+			tokens++;
+			if (token.type == TOKEN_EOF || token.type == TOKEN_ERROR) break;
+		}
+		passes++;
+	} while (seconds(start) < MIN_SECONDS);
+	double elapsed = seconds(start);
+	beginResult(name, elapsed, tokens);
+	addField("mb_per_s", (double)source.length * passes / (1024.0 * 1024.0) / elapsed);
+	addField("tokens_per_s", (double)tokens / elapsed);
+	endResult();
+	free(source.chars);
+}
+
+// 与gen_large_script.py生成的脚本相同：全局变量赋值、算术表达式和条件语句，所有的数字都事先放在几个全局变量里，这样不会超过常量数量的上限。
+static void benchCompile(int statements) {
+	Source source = { NULL, 0, 0 };
+	append(&source, "var total = 0;\nvar a = 1;\nvar b = 2;\nvar one = 1;\nvar limit = 1000;\n");
+	for (int i = 0; i < statements; i++) {
+		switch (i % 4) {
+			case 0: append(&source, "total = total + a * b - one;\n"); break;
+			case 1: append(&source, "if (total > limit) total = total - limit;\n"); break;
+			case 2: append(&source, "a = (a + one) *\n  b - (total -\n  one);\n"); break;
+			default: append(&source, "print total;\n"); break;
+		}
+	}
+	int lines = 0;
+	for (int i = 0; i < source.length; i++) lines += source.chars[i] == '\n';
+
+	long long compiles = 0;
+	clock_t start = clock();
+	do {
+		// 每次都编译到一个新的字节码块中，编译完就释放它，就像interpret()那样。
+		Chunk chunk;
+		initChunk(&chunk);
+		if (compile(source.chars, &chunk) == NULL) {
+			fprintf(stderr, "compile failed\n");
+			exit(1);
+		}
+		freeChunk(&chunk);
+		compiles++;
+	} while (seconds(start) < MIN_SECONDS);
+	double elapsed = seconds(start);
+	beginResult("compile", elapsed, compiles);
+	addField("lines_per_s", (double)lines * compiles / elapsed);
+	addField("mb_per_s", (double)source.length * compiles / (1024.0 * 1024.0) / elapsed);
+	endResult();
+	free(source.chars);
+}
+
+// ------------------字符串驻留------------------
+
+static void benchIntern() {
+	// 每个名字占一个固定大小的槽，计时的循环中不需要再格式化字符串。
+	static char names[INTERN_BATCH][32];
+	static int lengths[INTERN_BATCH];
+	for (int i = 0; i < INTERN_BATCH; i++) lengths[i] = snprintf(names[i], sizeof(names[i]), "interned name %d", i);
+
+	// 命中：先驻留所有的名字，再把它们放进vm.hostRoots，让它们在计时过程中不会被回收。
+	if (selected("intern_copy_hit")) {
+		for (int i = 0; i < INTERN_BATCH; i++) retainValue(OBJ_VAL(copyString(names[i], lengths[i])));
+		long long operations = 0;
+		clock_t start = clock();
+		do {
+			for (int i = 0; i < INTERN_BATCH; i++) copyString(names[i], lengths[i]);
+			operations += INTERN_BATCH;
+		} while (seconds(start) < MIN_SECONDS);
+		report("intern_copy_hit", seconds(start), operations);
+		vm.hostRoots.count = 0;
+	}
+
+	// 未命中：每一批驻留之后，新字符串都不再被引用，一次（不计时的）回收会释放它们并把它们从驻留表中删除，所以下一批又都不命中。
+	for (int borrow = 0; borrow < 2; borrow++) {
+		const char* name = borrow ? "intern_borrow_miss" : "intern_copy_miss";
+		if (!selected(name)) continue;
+		collectGarbage();
+		long long operations = 0;
+		double elapsed = 0;
+		do {
+			clock_t start = clock();
+			for (int i = 0; i < INTERN_BATCH; i++) {
+				if (borrow) borrowString(names[i], lengths[i]);
+				else copyString(names[i], lengths[i]);
+			}
+			elapsed += seconds(start);
+			operations += INTERN_BATCH;
+			collectGarbage();
+		} while (elapsed < MIN_SECONDS);
+		report(name, elapsed, operations);
+	}
+}
+
+int main(int argc, const char* argv[]) {
+	if (argc > 1) filter = argv[1];
+	initVM();
+
+	printf("{\n  \"min_seconds\": %.2f,\n  \"benchmarks\": [", MIN_SECONDS);
+	benchTables();
+	if (selected("scan_code")) benchScan("scan_code", codeSource(100000));
+	if (selected("scan_comments")) benchScan("scan_comments", commentSource(100000));
+	if (selected("scan_strings")) benchScan("scan_strings", stringSource(100000));
+	if (selected("compile")) benchCompile(20000);
+	benchIntern();
+	printf("\n  ]\n}\n");
+
+	freeVM();
+	return 0;
+}
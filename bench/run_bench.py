@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# 运行bench目录中的基准测试，以JSON格式报告墙钟时间和峰值内存的统计结果。
+# 用法：
+#   python3 bench/run_bench.py path/to/CSalmon [-n 10] [--warmup 1] [--filter 名称] [--compile-statements 100000] [-o result.json]
+# 每个bench/*.salmon脚本都运行N次（之前先运行warmup次，结果丢弃），每次记录墙钟时间和子进程的峰值常驻内存。
+# 另外还有一个compile_large用例：用gen_large_script.py生成一个很大的脚本，然后用--compile-only只编译它，衡量编译速度。
+# 对每个用例，报告时间和峰值内存的中位数、p95（最近秩法）、标准差、最小值和最大值，时间的单位是秒，内存的单位是KB。
+# 脚本的输出被丢弃。任何一次运行（包括warmup）的退出码不为0时，这个用例就停止运行，结果中只记录退出码，时间和内存都记为null，
+# 因为出错的运行衡量的是错误处理的路径，而不是基准本身。所有用例都运行完之后，以非0的退出码结束。
+# 峰值内存来自os.wait4()返回的ru_maxrss，在没有这个函数的平台（Windows）上记为null。
+import argparse
+import json
+import math
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+def run_once(command):
+    start = time.perf_counter()
+    process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if hasattr(os, "wait4"):
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        code = os.waitstatus_to_exitcode(status)
+        # Linux以KB为单位报告ru_maxrss，macOS则以字节为单位。
+        rss = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+        return elapsed, rss, code
+    code = process.wait()
+    return time.perf_counter() - start, None, code
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    rank = max(1, math.ceil(fraction * len(ordered)))
+    return ordered[rank - 1]
+
+def summarize(values):
+    if any(value is None for value in values):
+        return None
+    return {
+        "median": statistics.median(values),
+        "p95": percentile(values, 0.95),
+        "stddev": statistics.stdev(values) if len(values) > 1 else 0.0,
+        "min": min(values),
+        "max": max(values),
+    }
+
+def failed(name, command, code):
+    print("%-16s FAILED with exit code %d, no timings recorded" % (name, code), file=sys.stderr)
+    return {
+        "name": name,
+        "command": command,
+        "runs": 0,
+        "exit_codes": [code],
+        "wall_seconds": None,
+        "peak_rss_kb": None,
+    }
+
+def measure(name, command, runs, warmup):
+    for _ in range(warmup):
+        _, _, code = run_once(command)
+        if code != 0:
+            return failed(name, command, code)
+    times = []
+    rss = []
+    for _ in range(runs):
+        elapsed, peak, code = run_once(command)
+        if code != 0:
+            return failed(name, command, code)
+        times.append(elapsed)
+        rss.append(peak)
+    result = {
+        "name": name,
+        "command": command,
+        "runs": runs,
+        "exit_codes": [0],
+        "wall_seconds": summarize(times),
+        "peak_rss_kb": summarize(rss),
+    }
+    print("%-16s median %8.4fs  p95 %8.4fs" % (name, result["wall_seconds"]["median"], result["wall_seconds"]["p95"]), file=sys.stderr)
+    return result
+
+def main():
+    parser = argparse.ArgumentParser(description="运行Salmon基准测试并以JSON格式报告结果。")
+    parser.add_argument("binary", help="CSalmon可执行文件的路径")
+    parser.add_argument("-n", "--runs", type=int, default=10, help="每个用例计时的运行次数")
+    parser.add_argument("--warmup", type=int, default=1, help="计时之前丢弃的运行次数")
+    parser.add_argument("--filter", default="", help="只运行名称中包含这个字符串的用例")
+    parser.add_argument("--compile-statements", type=int, default=100000, help="compile_large用例生成的语句数")
+    parser.add_argument("-o", "--output", help="把JSON写入这个文件，而不是标准输出")
+    args = parser.parse_args()
+    if args.runs < 1:
+        parser.error("-n must be at least 1")
+
+    binary = os.path.abspath(args.binary)
+    cases = []
+    for file in sorted(os.listdir(BENCH_DIR)):
+        if file.endswith(".salmon"):
+            cases.append((file[:-len(".salmon")], [binary, os.path.join(BENCH_DIR, file)]))
+
+    work = tempfile.mkdtemp(prefix="salmon-bench-")
+    try:
+        if args.filter in "compile_large":
+            source = os.path.join(work, "large.salmon")
+            with open(source, "w") as out:
+                subprocess.run([sys.executable, os.path.join(BENCH_DIR, "gen_large_script.py"), str(args.compile_statements)], stdout=out, check=True)
+            cases.append(("compile_large", [binary, "--compile-only", "-o", os.path.join(work, "large.salc"), source]))
+
+        results = [measure(name, command, args.runs, args.warmup) for name, command in cases if args.filter in name]
+    finally:
+        shutil.rmtree(work, ignore_errors=True)
+
+    report = {
+        "binary": binary,
+        "machine": {
+            "system": platform.system(),
+            "release": platform.release(),
+            "processor": platform.machine(),
+            "cpus": os.cpu_count(),
+            "python": platform.python_version(),
+        },
+        "runs": args.runs,
+        "warmup": args.warmup,
+        "benchmarks": results,
+    }
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as out:
+            out.write(text + "\n")
+    else:
+        print(text)
+
+    if any(code != 0 for result in results for code in result["exit_codes"]):
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()